@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crbuf.h"
+
+#define ARENATEST_CHUNK 1024
+#define ARENATEST_SIZE 256
+
+static int failed = 0;
+
+#define ARENATEST_CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		failed = 1; \
+	} \
+} while (0)
+
+// buffers come out of the current arena back to back until the chunk is
+// full, larger ones and anything outside carena_use fall back to the heap
+static void arenatest_chunk(void) {
+	carena_t a;
+	struct crbuf_s* b[4];
+	struct crbuf_s* other;
+	char* first;
+	int i;
+
+	carena_init(&a, ARENATEST_CHUNK);
+	other = crbuf_new(ARENATEST_SIZE);
+	ARENATEST_CHECK(!(other->flags & CRBUF_ARENA));
+	crbuf_unref(other);
+	ARENATEST_CHECK(carena_use(&a) == NULL);
+	for (i = 0; i < 4; ++i) {
+		b[i] = crbuf_new(ARENATEST_SIZE);
+		ARENATEST_CHECK(b[i]->flags & CRBUF_ARENA);
+		ARENATEST_CHECK(b[i]->rc == 1 && b[i]->length == ARENATEST_SIZE);
+		memset(b[i]->data, 'a' + i, ARENATEST_SIZE);
+	}
+	ARENATEST_CHECK(a.live == 4);
+	// the first three share a chunk at a fixed stride, the fourth rolls over
+	ARENATEST_CHECK(b[2]->data - b[1]->data == b[1]->data - b[0]->data);
+	ARENATEST_CHECK(b[1]->data - b[0]->data >= ARENATEST_SIZE);
+	ARENATEST_CHECK(a.head != a.cur);
+	first = b[0]->data;
+
+	other = crbuf_new(ARENATEST_CHUNK);
+	ARENATEST_CHECK(!(other->flags & CRBUF_ARENA));
+	crbuf_unref(other);
+
+	for (i = 0; i < 4; ++i) {
+		ARENATEST_CHECK(b[i]->data[0] == 'a' + i && b[i]->data[ARENATEST_SIZE - 1] == 'a' + i);
+		crbuf_unref(b[i]);
+	}
+	ARENATEST_CHECK(a.live == 0);
+
+	// with nothing live a reset hands out the same memory again
+	carena_reset(&a);
+	b[0] = crbuf_new(ARENATEST_SIZE);
+	ARENATEST_CHECK(b[0]->data == first && a.head == a.cur);
+	crbuf_unref(b[0]);
+
+	ARENATEST_CHECK(carena_use(NULL) == &a);
+	other = crbuf_new(ARENATEST_SIZE);
+	ARENATEST_CHECK(!(other->flags & CRBUF_ARENA));
+	crbuf_unref(other);
+	carena_fini(&a);
+}
+
+// a reset with buffers still referenced detaches their chunks, later
+// allocations never land on them and the last unref frees the chunk
+static void arenatest_reset_live(void) {
+	carena_t a;
+	struct crbuf_s* kept;
+	struct crbuf_s* b[4];
+	int i;
+
+	carena_init(&a, ARENATEST_CHUNK);
+	carena_use(&a);
+	kept = crbuf_new(ARENATEST_SIZE);
+	b[0] = crbuf_new(ARENATEST_SIZE);
+	memset(kept->data, 'k', ARENATEST_SIZE);
+	crbuf_unref(b[0]);
+	ARENATEST_CHECK(a.live == 1);
+
+	carena_reset(&a);
+	ARENATEST_CHECK(a.live == 0 && a.head == NULL);
+	for (i = 0; i < 4; ++i) {
+		b[i] = crbuf_new(ARENATEST_SIZE);
+		ARENATEST_CHECK(b[i]->flags & CRBUF_ARENA);
+		memset(b[i]->data, 'n', ARENATEST_SIZE);
+	}
+	ARENATEST_CHECK(kept->data[0] == 'k' && kept->data[ARENATEST_SIZE - 1] == 'k');
+	ARENATEST_CHECK(a.live == 4);
+
+	// the detached chunk goes with its last buffer, the arena is untouched
+	crbuf_unref(kept);
+	ARENATEST_CHECK(a.live == 4);
+	for (i = 0; i < 4; ++i)
+		crbuf_unref(b[i]);
+	ARENATEST_CHECK(a.live == 0);
+	carena_fini(&a);
+}
+
+// buffers outliving the arena itself stay valid and free their chunk
+static void arenatest_fini_live(void) {
+	carena_t a;
+	struct crbuf_s* kept[2];
+
+	carena_init(&a, ARENATEST_CHUNK);
+	carena_use(&a);
+	kept[0] = crbuf_new(ARENATEST_SIZE);
+	kept[1] = crbuf_new(ARENATEST_SIZE);
+	memset(kept[0]->data, 'x', ARENATEST_SIZE);
+	memset(kept[1]->data, 'y', ARENATEST_SIZE);
+	carena_fini(&a);
+
+	// fini leaves no current arena behind
+	ARENATEST_CHECK(carena_use(NULL) == NULL);
+	ARENATEST_CHECK(kept[0]->data[ARENATEST_SIZE - 1] == 'x');
+	ARENATEST_CHECK(kept[1]->data[ARENATEST_SIZE - 1] == 'y');
+	crbuf_unref(kept[0]);
+	ARENATEST_CHECK(kept[1]->data[0] == 'y');
+	crbuf_unref(kept[1]);
+}
+
+int main(void) {
+	arenatest_chunk();
+	arenatest_reset_live();
+	arenatest_fini_live();
+	printf("cbuf-arena: %s\n", failed ? "FAILED" : "ok");
+	return failed;
+}
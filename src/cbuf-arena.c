@@ -0,0 +1,128 @@
+#include <assert.h>
+#include <stdlib.h>
+
+#include "crbuf.h"
+
+#ifndef CARENA_CHUNK_SIZE
+# define CARENA_CHUNK_SIZE 65536
+#endif
+
+#define CARENA_ALIGN(n) (((n) + 7) & ~(ssize_t)7)
+
+struct carena_chunk_s {
+	struct carena_chunk_s* next;
+	carena_t* arena;
+	ssize_t live;
+	ssize_t size;
+	ssize_t used;
+	char data[1];
+};
+
+struct carena_rbuf_s {
+	struct carena_chunk_s* chunk;
+	struct crbuf_s raw;
+};
+
+static CX_THREAD_LOCAL carena_t* carena_current = NULL;
+
+static struct carena_chunk_s* carena_chunk_new(carena_t* arena) {
+	struct carena_chunk_s* c = CX_NEW2(MALLOC, struct carena_chunk_s, data, arena->chunk_size);
+	c->next = NULL;
+	c->arena = arena;
+	c->live = 0;
+	c->size = arena->chunk_size;
+	c->used = 0;
+	return c;
+}
+
+struct crbuf_s* carena_crbuf_new(ssize_t length) {
+	carena_t* arena = carena_current;
+	struct carena_chunk_s* c;
+	struct carena_rbuf_s* r;
+	ssize_t need;
+
+	if (arena == NULL)
+		return NULL;
+	need = CARENA_ALIGN(offsetof(struct carena_rbuf_s, raw.data) + length);
+	if (need > arena->chunk_size / 2)
+		return NULL;
+
+	c = arena->cur;
+	if (c == NULL) {
+		c = arena->head = arena->cur = carena_chunk_new(arena);
+	} else if (c->size - c->used < need) {
+		if (c->next == NULL)
+			c->next = carena_chunk_new(arena);
+		c = arena->cur = c->next;
+		c->used = 0;
+	}
+
+	r = (struct carena_rbuf_s*)((void*)(c->data + c->used));
+	c->used += need;
+	++c->live;
+	++arena->live;
+	r->chunk = c;
+	r->raw.rc = 1;
+	r->raw.flags = CRBUF_ARENA;
+	r->raw.length = length;
+	return &r->raw;
+}
+
+void carena_crbuf_free(struct crbuf_s* raw) {
+	struct carena_chunk_s* c = CX_GET_SELF(raw, struct carena_rbuf_s, raw)->chunk;
+	--c->live;
+	if (c->arena)
+		--c->arena->live;
+	else if (c->live == 0)
+		FREE(c);
+}
+
+carena_t* carena_init(carena_t* self, ssize_t chunk_size) {
+	self->chunk_size = chunk_size > 0 ? chunk_size : CARENA_CHUNK_SIZE;
+	self->live = 0;
+	self->head = self->cur = NULL;
+	return self;
+}
+
+carena_t* carena_fini(carena_t* self) {
+	struct carena_chunk_s* c;
+
+	carena_reset(self);
+	while ((c = self->head) != NULL) {
+		self->head = c->next;
+		FREE(c);
+	}
+	self->cur = NULL;
+	if (carena_current == self)
+		carena_current = NULL;
+	return self;
+}
+
+carena_t* carena_reset(carena_t* self) {
+	if (self->live > 0) {
+		// buffers still referenced keep their chunk, which leaves the arena
+		struct carena_chunk_s** pc = &self->head;
+		struct carena_chunk_s* c;
+		while ((c = *pc) != NULL) {
+			if (c->live > 0) {
+				*pc = c->next;
+				c->next = NULL;
+				c->arena = NULL;
+			} else {
+				pc = &c->next;
+			}
+		}
+		self->live = 0;
+	}
+
+	self->cur = self->head;
+	if (self->cur)
+		self->cur->used = 0;
+	return self;
+}
+
+carena_t* carena_use(carena_t* self) {
+	carena_t* prev = carena_current;
+	carena_current = self;
+	return prev;
+}
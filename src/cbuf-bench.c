@@ -0,0 +1,494 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "cbuf.h"
+
+#define BENCH_MAX_EVENTS 64
+#define BENCH_MAX_LIST 16
+
+// every allocation made by the cbuf library in this binary goes through here
+static volatile long bench_allocs = 0;
+
+void* bench_malloc(size_t n) {
+	__sync_fetch_and_add(&bench_allocs, 1);
+	return malloc(n);
+}
+
+void* bench_realloc(void* p, size_t n) {
+	__sync_fetch_and_add(&bench_allocs, 1);
+	return realloc(p, n);
+}
+
+void bench_free(void* p) {
+	free(p);
+}
+
+struct bench_opts {
+	int sizes[BENCH_MAX_LIST];
+	int nsizes;
+	int conns[BENCH_MAX_LIST];
+	int nconns;
+	int messages;
+	int read_size;
+	int modes;
+	int transports;
+};
+
+enum {
+	BENCH_ECHO = 1,
+	BENCH_PROXY = 2,
+	BENCH_TCP = 1,
+	BENCH_UNIX = 2,
+};
+
+struct bench_addr {
+	struct sockaddr_storage ss;
+	socklen_t len;
+};
+
+struct bench_conn {
+	int fd;
+	int closed;
+	cbufs_t in;
+	ctrunk_t out;
+	struct bench_conn* peer;
+};
+
+struct bench_server {
+	int lfd;
+	int stop[2];
+	int transport;
+	const struct bench_addr* backend;
+	int read_size;
+	pthread_t thread;
+};
+
+struct bench_client {
+	const struct bench_addr* addr;
+	int transport;
+	int size;
+	int messages;
+	double* latencies;
+	pthread_t thread;
+};
+
+static double bench_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench_die(const char* what) {
+	perror(what);
+	exit(1);
+}
+
+static int bench_socket(int transport) {
+	int fd = socket(transport == BENCH_TCP ? AF_INET : AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		bench_die("socket");
+	if (transport == BENCH_TCP) {
+		int on = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	}
+	return fd;
+}
+
+static int bench_listen(int transport, struct bench_addr* addr) {
+	int fd = bench_socket(transport);
+	memset(addr, 0, sizeof(*addr));
+	if (transport == BENCH_TCP) {
+		struct sockaddr_in* sin = (struct sockaddr_in*)&addr->ss;
+		int on = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		sin->sin_family = AF_INET;
+		sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr->len = sizeof(*sin);
+	} else {
+		// abstract namespace, nothing to clean up on disk
+		static int seq = 0;
+		struct sockaddr_un* sun = (struct sockaddr_un*)&addr->ss;
+		sun->sun_family = AF_UNIX;
+		snprintf(sun->sun_path + 1, sizeof(sun->sun_path) - 1, "cbuf-bench-%d-%d", (int)getpid(), ++seq);
+		addr->len = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(sun->sun_path + 1);
+	}
+
+	if (bind(fd, (struct sockaddr*)&addr->ss, addr->len) != 0)
+		bench_die("bind");
+	if (listen(fd, 1024) != 0)
+		bench_die("listen");
+	if (transport == BENCH_TCP && getsockname(fd, (struct sockaddr*)&addr->ss, &addr->len) != 0)
+		bench_die("getsockname");
+	return fd;
+}
+
+static int bench_connect(int transport, const struct bench_addr* addr) {
+	int fd = bench_socket(transport);
+	if (connect(fd, (const struct sockaddr*)&addr->ss, addr->len) != 0)
+		bench_die("connect");
+	return fd;
+}
+
+static void bench_nonblock(int fd) {
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+static int bench_writev_all(int fd, struct iovec* iov, int n) {
+	while (n > 0) {
+		ssize_t w = writev(fd, iov, n > IOV_MAX ? IOV_MAX : n);
+		if (w < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				struct pollfd pfd = { fd, POLLOUT, 0 };
+				poll(&pfd, 1, -1);
+				continue;
+			}
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		while (n > 0 && (size_t)w >= iov->iov_len) {
+			w -= iov->iov_len;
+			++iov;
+			--n;
+		}
+		if (n > 0) {
+			iov->iov_base = (char*)iov->iov_base + w;
+			iov->iov_len -= w;
+		}
+	}
+
+	return 0;
+}
+
+// write the whole trunk, releasing each buffer as soon as it has been sent
+static int bench_flush(int fd, ctrunk_t* out) {
+	while (out->nbufs > 0) {
+		cx_buf_t* bufs;
+		ssize_t n = ctrunk_batch(out, &bufs);
+		ssize_t w = writev(fd, (struct iovec*)bufs, (int)n);
+		if (w < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				struct pollfd pfd = { fd, POLLOUT, 0 };
+				poll(&pfd, 1, -1);
+				continue;
+			}
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		ctrunk_consume(out, w);
+	}
+
+	return 0;
+}
+
+static struct bench_conn* bench_conn_new(int fd) {
+	struct bench_conn* c = (struct bench_conn*)calloc(1, sizeof(struct bench_conn));
+	c->fd = fd;
+	cbufs_init(&c->in);
+	ctrunk_init(&c->out, 64);
+	bench_nonblock(fd);
+	return c;
+}
+
+static void bench_conn_free(struct bench_conn* c) {
+	close(c->fd);
+	cbufs_fini(&c->in);
+	ctrunk_fini(&c->out);
+	free(c);
+}
+
+// read what is available, forward every complete frame to the peer
+static int bench_conn_read(struct bench_conn* c, int read_size) {
+	for (;;) {
+		cbuf_t b;
+		char* p = cbuf_init2(&b, read_size);
+		ssize_t n = read(c->fd, p, read_size);
+		ssize_t i;
+
+		if (n <= 0) {
+			cbuf_fini(&b);
+			if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				break;
+			if (n < 0 && errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		cbuf_pop(&b, read_size - n, NULL);
+		cbufs_push(&c->in, &b, 1);
+
+		while ((i = cbufs_find(&c->in, '\n')) >= 0)
+			cbufs_shift_to_trunk(&c->in, i + 1, &c->peer->out);
+
+		if (bench_flush(c->peer->fd, &c->peer->out) != 0)
+			return -1;
+
+		if (n < read_size)
+			break;
+	}
+
+	return 0;
+}
+
+static void bench_epoll_add(int ep, int fd, void* ptr) {
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = ptr;
+	if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) != 0)
+		bench_die("epoll_ctl");
+}
+
+static void* bench_server_main(void* arg) {
+	struct bench_server* s = (struct bench_server*)arg;
+	struct epoll_event events[BENCH_MAX_EVENTS];
+	int ep = epoll_create1(EPOLL_CLOEXEC);
+	int running = 1;
+
+	bench_epoll_add(ep, s->lfd, &s->lfd);
+	bench_epoll_add(ep, s->stop[0], &s->stop);
+
+	while (running) {
+		int n = epoll_wait(ep, events, BENCH_MAX_EVENTS, -1);
+		int i;
+		for (i = 0; i < n; ++i) {
+			void* ptr = events[i].data.ptr;
+			if (ptr == &s->stop) {
+				running = 0;
+			} else if (ptr == &s->lfd) {
+				int fd = accept4(s->lfd, NULL, NULL, SOCK_CLOEXEC);
+				struct bench_conn* c;
+				if (fd < 0)
+					continue;
+				c = bench_conn_new(fd);
+				if (s->backend) {
+					c->peer = bench_conn_new(bench_connect(s->transport, s->backend));
+					c->peer->peer = c;
+					bench_epoll_add(ep, c->peer->fd, c->peer);
+				} else {
+					c->peer = c;
+				}
+				bench_epoll_add(ep, fd, c);
+			} else {
+				struct bench_conn* c = (struct bench_conn*)ptr;
+				if (!c->closed && bench_conn_read(c, s->read_size) != 0) {
+					// closing one side of a proxied pair closes both
+					c->closed = 1;
+					epoll_ctl(ep, EPOLL_CTL_DEL, c->fd, NULL);
+					if (c->peer != c) {
+						c->peer->closed = 1;
+						epoll_ctl(ep, EPOLL_CTL_DEL, c->peer->fd, NULL);
+						bench_conn_free(c->peer);
+					}
+					bench_conn_free(c);
+				}
+			}
+		}
+	}
+
+	close(ep);
+	return NULL;
+}
+
+static void bench_server_start(struct bench_server* s, int transport, struct bench_addr* addr, const struct bench_addr* backend, int read_size) {
+	s->transport = transport;
+	s->backend = backend;
+	s->read_size = read_size;
+	s->lfd = bench_listen(transport, addr);
+	if (pipe2(s->stop, O_CLOEXEC) != 0)
+		bench_die("pipe");
+	pthread_create(&s->thread, NULL, bench_server_main, s);
+}
+
+static void bench_server_stop(struct bench_server* s) {
+	if (write(s->stop[1], "x", 1) != 1)
+		bench_die("write");
+	pthread_join(s->thread, NULL);
+	close(s->stop[0]);
+	close(s->stop[1]);
+	close(s->lfd);
+}
+
+static void* bench_client_main(void* arg) {
+	struct bench_client* c = (struct bench_client*)arg;
+	int fd = bench_connect(c->transport, c->addr);
+	char* msg = (char*)malloc(c->size);
+	char* reply = (char*)malloc(c->size);
+	int i;
+
+	memset(msg, 'x', c->size - 1);
+	msg[c->size - 1] = '\n';
+
+	for (i = 0; i < c->messages; ++i) {
+		double t0 = bench_now();
+		ssize_t got = 0;
+		struct iovec iov = { msg, (size_t)c->size };
+
+		if (bench_writev_all(fd, &iov, 1) != 0)
+			bench_die("client write");
+		while (got < c->size) {
+			ssize_t n = read(fd, reply + got, c->size - got);
+			if (n <= 0)
+				bench_die("client read");
+			got += n;
+		}
+		c->latencies[i] = bench_now() - t0;
+	}
+
+	close(fd);
+	free(msg);
+	free(reply);
+	return NULL;
+}
+
+static int bench_cmp(const void* a, const void* b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+
+static void bench_run(const struct bench_opts* o, int mode, int transport, int size, int conns) {
+	struct bench_server echo, proxy;
+	struct bench_addr echo_addr, proxy_addr;
+	struct bench_client* clients = (struct bench_client*)calloc(conns, sizeof(struct bench_client));
+	long total = (long)conns * o->messages;
+	double* latencies = (double*)malloc(sizeof(double) * total);
+	double t0, elapsed;
+	long allocs;
+	int i;
+
+	bench_server_start(&echo, transport, &echo_addr, NULL, o->read_size);
+	if (mode == BENCH_PROXY)
+		bench_server_start(&proxy, transport, &proxy_addr, &echo_addr, o->read_size);
+
+	allocs = bench_allocs;
+	t0 = bench_now();
+	for (i = 0; i < conns; ++i) {
+		clients[i].addr = mode == BENCH_PROXY ? &proxy_addr : &echo_addr;
+		clients[i].transport = transport;
+		clients[i].size = size;
+		clients[i].messages = o->messages;
+		clients[i].latencies = latencies + (long)i * o->messages;
+		pthread_create(&clients[i].thread, NULL, bench_client_main, &clients[i]);
+	}
+	for (i = 0; i < conns; ++i)
+		pthread_join(clients[i].thread, NULL);
+	elapsed = bench_now() - t0;
+	allocs = bench_allocs - allocs;
+
+	if (mode == BENCH_PROXY)
+		bench_server_stop(&proxy);
+	bench_server_stop(&echo);
+
+	qsort(latencies, total, sizeof(double), bench_cmp);
+	printf("%-5s %-5s size=%-6d conns=%-4d msgs=%-8ld %9.1f MB/s %10.0f msg/s  p50=%8.1fus p99=%8.1fus  allocs/msg=%.2f\n",
+		transport == BENCH_TCP ? "tcp" : "unix",
+		mode == BENCH_ECHO ? "echo" : "proxy",
+		size, conns, total,
+		total * (double)size / elapsed / (1024 * 1024),
+		total / elapsed,
+		latencies[total / 2] * 1e6,
+		latencies[total * 99 / 100] * 1e6,
+		(double)allocs / total);
+	fflush(stdout);
+
+	free(latencies);
+	free(clients);
+}
+
+static int bench_parse_list(const char* s, int* out) {
+	int n = 0;
+	while (*s && n < BENCH_MAX_LIST) {
+		char* e;
+		long v = strtol(s, &e, 10);
+		if (e == s || v <= 0)
+			return -1;
+		out[n++] = (int)v;
+		s = (*e == ',') ? e + 1 : e;
+	}
+	return n;
+}
+
+static void bench_usage(const char* prog) {
+	fprintf(stderr,
+		"usage: %s [-s sizes] [-c conns] [-n messages] [-r read_size] [-m echo,proxy] [-t tcp,unix] [-P]\n"
+		"  -s  comma separated message sizes in bytes, default 64,1024,16384\n"
+		"  -c  comma separated connection counts, default 1,8,32\n"
+		"  -n  messages per connection, default 2000\n"
+		"  -r  server read size, default 65536\n"
+		"  -P  serve large buffers from the hugepage/NUMA pool\n", prog);
+	exit(2);
+}
+
+int main(int argc, char** argv) {
+	struct bench_opts o;
+	int ch, m, t, i, j;
+
+	o.nsizes = bench_parse_list("64,1024,16384", o.sizes);
+	o.nconns = bench_parse_list("1,8,32", o.conns);
+	o.messages = 2000;
+	o.read_size = 65536;
+	o.modes = BENCH_ECHO | BENCH_PROXY;
+	o.transports = BENCH_TCP | BENCH_UNIX;
+
+	while ((ch = getopt(argc, argv, "s:c:n:r:m:t:P")) != -1) {
+		switch (ch) {
+		case 's':
+			if ((o.nsizes = bench_parse_list(optarg, o.sizes)) <= 0)
+				bench_usage(argv[0]);
+			break;
+		case 'c':
+			if ((o.nconns = bench_parse_list(optarg, o.conns)) <= 0)
+				bench_usage(argv[0]);
+			break;
+		case 'n':
+			if ((o.messages = atoi(optarg)) <= 0)
+				bench_usage(argv[0]);
+			break;
+		case 'r':
+			if ((o.read_size = atoi(optarg)) <= 0)
+				bench_usage(argv[0]);
+			break;
+		case 'm':
+			o.modes = (strstr(optarg, "echo") ? BENCH_ECHO : 0) | (strstr(optarg, "proxy") ? BENCH_PROXY : 0);
+			break;
+		case 't':
+			o.transports = (strstr(optarg, "tcp") ? BENCH_TCP : 0) | (strstr(optarg, "unix") ? BENCH_UNIX : 0);
+			break;
+		case 'P':
+			cpool_configure(CPOOL_ENABLE | CPOOL_THP | CPOOL_NUMA, 0);
+			break;
+		default:
+			bench_usage(argv[0]);
+		}
+	}
+
+	for (t = BENCH_TCP; t <= BENCH_UNIX; t <<= 1) {
+		if (!(o.transports & t))
+			continue;
+		for (m = BENCH_ECHO; m <= BENCH_PROXY; m <<= 1) {
+			if (!(o.modes & m))
+				continue;
+			for (i = 0; i < o.nsizes; ++i)
+				for (j = 0; j < o.nconns; ++j)
+					bench_run(&o, m, t, o.sizes[i], o.conns[j]);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,133 @@
+#include <assert.h>
+#include <string.h>
+
+#include "crbuf.h"
+
+#ifndef CBUILDER_CHUNK_MIN
+# define CBUILDER_CHUNK_MIN 256
+#endif
+
+#ifndef CBUILDER_CHUNK_MAX
+# define CBUILDER_CHUNK_MAX (4 * 1024 * 1024)
+#endif
+
+// buffers at least this long are referenced by cbuilder_append, not copied
+#define CBUILDER_REF_MIN 256
+
+cbuilder_t* cbuilder_init(cbuilder_t* self, ssize_t hint) {
+	cbufs_init(&self->bufs);
+	self->cur.raw = NULL;
+	self->cur.start = self->cur.end = 0;
+	self->chunk = hint > CBUILDER_CHUNK_MIN ? hint : CBUILDER_CHUNK_MIN;
+	return self;
+}
+
+cbuilder_t* cbuilder_fini(cbuilder_t* self) {
+	cbufs_fini(&self->bufs);
+	cbuf_fini(&self->cur);
+	return self;
+}
+
+ssize_t cbuilder_length(cbuilder_t* self) {
+	return self->bufs.length + (self->cur.end - self->cur.start);
+}
+
+// move the written part of the current chunk to bufs, keeping the spare room
+static void cbuilder_flush(cbuilder_t* self, int keep) {
+	if (self->cur.end > self->cur.start) {
+		cbuf_t t = cbuf_ref(&self->cur, !keep);
+		cbufs_push(&self->bufs, &t, 1);
+		self->cur.start = self->cur.end;
+	}
+	if (!keep)
+		cbuf_fini(&self->cur);
+}
+
+char* cbuilder_reserve(cbuilder_t* self, ssize_t n) {
+	struct crbuf_s* raw = self->cur.raw;
+
+	if (raw == NULL || raw->length - self->cur.end < n) {
+		ssize_t size = self->chunk;
+		cbuilder_flush(self, 0);
+		if (size < n)
+			size = n;
+		cbuf_init2(&self->cur, size);
+		self->cur.end = 0;
+		if (self->chunk < CBUILDER_CHUNK_MAX)
+			self->chunk *= 2;
+		raw = self->cur.raw;
+	}
+
+	return raw->data + self->cur.end;
+}
+
+void cbuilder_commit(cbuilder_t* self, ssize_t n) {
+	assert(n >= 0 && self->cur.end + n <= (self->cur.raw ? self->cur.raw->length : 0));
+	self->cur.end += n;
+}
+
+void cbuilder_write(cbuilder_t* self, const void* data, ssize_t length) {
+	const char* s = (const char*)data;
+
+	while (length > 0) {
+		struct crbuf_s* raw = self->cur.raw;
+		ssize_t n = raw ? raw->length - self->cur.end : 0;
+		if (n == 0) {
+			cbuilder_reserve(self, 1);
+			raw = self->cur.raw;
+			n = raw->length - self->cur.end;
+		}
+		if (n > length)
+			n = length;
+		memcpy(raw->data + self->cur.end, s, n);
+		self->cur.end += n;
+		s += n;
+		length -= n;
+	}
+}
+
+void cbuilder_append(cbuilder_t* self, cbuf_t* buf, int transfer_reference) {
+	ssize_t length = cbuf_length(buf);
+
+	if (length < CBUILDER_REF_MIN) {
+		cbuilder_write(self, cbuf_base(buf), length);
+		if (transfer_reference)
+			cbuf_fini(buf);
+	} else {
+		cbuilder_flush(self, 1);
+		cbufs_push(&self->bufs, buf, transfer_reference);
+	}
+}
+
+void cbuilder_varint(cbuilder_t* self, uint64_t v) {
+	unsigned char* p = (unsigned char*)cbuilder_reserve(self, 10);
+	ssize_t n = 0;
+
+	while (v >= 0x80) {
+		p[n++] = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	p[n++] = (unsigned char)v;
+	self->cur.end += n;
+}
+
+void cbuilder_finish(cbuilder_t* self, cbufs_t* target) {
+	cbuilder_flush(self, 0);
+	cbufs_concat(target, &self->bufs);
+}
+
+void cbuilder_finish_buf(cbuilder_t* self, cbuf_t* target) {
+	cx_queue_t* bufs = &self->bufs.bufs;
+
+	cbuilder_flush(self, 0);
+	if (self->bufs.length == 0) {
+		target->raw = NULL;
+		target->start = target->end = 0;
+	} else if (cx_queue_head(bufs) == cx_queue_tail(bufs)) {
+		cbufs_peek(&self->bufs, -1, target);
+	} else {
+		// only reached when the output outgrew the first chunk
+		char* p = cbuf_init2(target, self->bufs.length);
+		cbufs_shift_to(&self->bufs, -1, p);
+	}
+}
@@ -0,0 +1,276 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "crbuf.h"
+
+#define CCACHE_SLOTS_MIN 64
+#define CCACHE_SEED 0
+
+struct ccache_entry_s {
+	struct ccache_entry_s* next;
+	cx_queue_t qh;
+	uint64_t hash;
+	cbuf_t buf;
+	int pinned;
+};
+
+static struct ccache_entry_s** ccache_slots(ssize_t nslots) {
+	struct ccache_entry_s** slots = (struct ccache_entry_s**)MALLOC(nslots * sizeof(struct ccache_entry_s*));
+	memset(slots, 0, nslots * sizeof(struct ccache_entry_s*));
+	return slots;
+}
+
+static uint64_t ccache_hash(const void* data, ssize_t length) {
+	cxxh64_t h;
+	cxxh64_update(cxxh64_init(&h, CCACHE_SEED), data, length);
+	return cxxh64_digest(&h);
+}
+
+static void ccache_empty(cbuf_t* target) {
+	if (target) {
+		target->raw = NULL;
+		target->start = target->end = 0;
+	}
+}
+
+ccache_t* ccache_init(ccache_t* self, ssize_t limit) {
+	self->limit = limit;
+	self->size = 0;
+	self->count = 0;
+	self->nslots = CCACHE_SLOTS_MIN;
+	self->slots = ccache_slots(self->nslots);
+	cx_queue_init(&self->lru);
+	cx_queue_init(&self->pinned);
+	self->npinned = 0;
+	self->pin_credit = 0;
+	self->hits = self->misses = self->evictions = 0;
+	return self;
+}
+
+static void ccache_drop(ccache_t* self, struct ccache_entry_s* e) {
+	struct ccache_entry_s** pp = &self->slots[e->hash & (self->nslots - 1)];
+
+	while (*pp != e)
+		pp = &(*pp)->next;
+	*pp = e->next;
+	cx_queue_remove0(&e->qh);
+	if (e->pinned)
+		--self->npinned;
+	self->size -= cbuf_length(&e->buf);
+	--self->count;
+	cbuf_fini(&e->buf);
+	FREE(e);
+}
+
+ccache_t* ccache_fini(ccache_t* self) {
+	while (!cx_queue_empty(&self->lru))
+		ccache_drop(self, CX_GET_SELF(cx_queue_head(&self->lru), struct ccache_entry_s, qh));
+	while (!cx_queue_empty(&self->pinned))
+		ccache_drop(self, CX_GET_SELF(cx_queue_head(&self->pinned), struct ccache_entry_s, qh));
+	FREE(self->slots);
+	self->slots = NULL;
+	return self;
+}
+
+static void ccache_grow(ccache_t* self) {
+	ssize_t nslots = self->nslots * 2;
+	struct ccache_entry_s** slots = ccache_slots(nslots);
+	ssize_t i;
+
+	for (i = 0; i < self->nslots; ++i) {
+		struct ccache_entry_s* e = self->slots[i];
+		while (e) {
+			struct ccache_entry_s* next = e->next;
+			struct ccache_entry_s** slot = &slots[e->hash & (nslots - 1)];
+			e->next = *slot;
+			*slot = e;
+			e = next;
+		}
+	}
+	FREE(self->slots);
+	self->slots = slots;
+	self->nslots = nslots;
+}
+
+// returns pinned entries the cache alone references again to the cold end
+// of the LRU
+static void ccache_unpin(ccache_t* self) {
+	cx_queue_t *q, *q2;
+
+	cx_queue_each2(q, q2, &self->pinned) {
+		struct ccache_entry_s* e = CX_GET_SELF(q, struct ccache_entry_s, qh);
+		if (e->buf.raw->rc > 1)
+			continue;
+		cx_queue_remove0(&e->qh);
+		cx_queue_push_front(&self->lru, &e->qh);
+		e->pinned = 0;
+		--self->npinned;
+	}
+	self->pin_credit = 0;
+}
+
+// evicts least recently used entries the cache alone still references;
+// dropping one that is shared elsewhere would free nothing, so it moves to
+// the pinned list where later scans do not visit it again
+static ssize_t ccache_evict(ccache_t* self, ssize_t limit) {
+	ssize_t freed = 0;
+	cx_queue_t *q, *q2;
+
+	cx_queue_each2(q, q2, &self->lru) {
+		struct ccache_entry_s* e;
+		if (self->size <= limit)
+			break;
+		e = CX_GET_SELF(q, struct ccache_entry_s, qh);
+		if (e->buf.raw->rc > 1) {
+			cx_queue_remove0(&e->qh);
+			cx_queue_push(&self->pinned, &e->qh);
+			e->pinned = 1;
+			++self->npinned;
+			continue;
+		}
+		freed += cbuf_length(&e->buf);
+		ccache_drop(self, e);
+		++self->evictions;
+	}
+	return freed;
+}
+
+ssize_t ccache_trim(ccache_t* self, ssize_t limit) {
+	ccache_unpin(self);
+	return ccache_evict(self, limit);
+}
+
+static int ccache_hit(ccache_t* self, struct ccache_entry_s* e, cbuf_t* target) {
+	cx_queue_remove0(&e->qh);
+	cx_queue_push(&self->lru, &e->qh);
+	if (e->pinned) {
+		e->pinned = 0;
+		--self->npinned;
+	}
+	++self->hits;
+	if (target)
+		*target = cbuf_ref(&e->buf, 0);
+	return 1;
+}
+
+static struct ccache_entry_s* ccache_insert(ccache_t* self, uint64_t hash, cbuf_t* buf) {
+	struct ccache_entry_s* e = CX_NEW(MALLOC, struct ccache_entry_s, 0);
+	struct ccache_entry_s** slot;
+
+	if (self->count >= self->nslots)
+		ccache_grow(self);
+	slot = &self->slots[hash & (self->nslots - 1)];
+	e->hash = hash;
+	e->buf = *buf;
+	e->buf.raw->flags |= CRBUF_READONLY;
+	e->pinned = 0;
+	e->next = *slot;
+	*slot = e;
+	cx_queue_push(&self->lru, &e->qh);
+	self->size += cbuf_length(buf);
+	++self->count;
+	++self->misses;
+	++self->pin_credit;
+	return e;
+}
+
+static struct ccache_entry_s* ccache_find(ccache_t* self, uint64_t hash, const char* data, ssize_t length) {
+	struct ccache_entry_s* e;
+
+	for (e = self->slots[hash & (self->nslots - 1)]; e; e = e->next) {
+		if (e->hash == hash && cbuf_length(&e->buf) == length &&
+			memcmp(cbuf_base(&e->buf), data, length) == 0)
+			break;
+	}
+	return e;
+}
+
+static int ccache_miss(ccache_t* self, uint64_t hash, cbuf_t* buf, cbuf_t* target) {
+	struct ccache_entry_s* e = ccache_insert(self, hash, buf);
+
+	if (target)
+		*target = cbuf_ref(&e->buf, 0);
+	// the pinned list is rescanned only after as many inserts as it holds,
+	// which keeps an insert amortised O(1) however many entries stay shared
+	if (self->size > self->limit && self->pin_credit >= self->npinned)
+		ccache_unpin(self);
+	ccache_evict(self, self->limit);
+	return 0;
+}
+
+// a payload found in the cache is returned as a new reference and 1;
+// otherwise a copy is stored and 0 returned. The caller's buffer is never
+// adopted, and stored copies are marked read-only since every hit shares
+// them.
+int ccache_put(ccache_t* self, cbuf_t* buf, cbuf_t* target) {
+	return ccache_put_data(self, cbuf_base(buf), cbuf_length(buf), target);
+}
+
+// as ccache_put, reading the payload from memory
+int ccache_put_data(ccache_t* self, const void* data, ssize_t length, cbuf_t* target) {
+	uint64_t hash;
+	struct ccache_entry_s* e;
+	cbuf_t t;
+
+	if (length <= 0) {
+		ccache_empty(target);
+		return 0;
+	}
+
+	hash = ccache_hash(data, length);
+	if ((e = ccache_find(self, hash, (const char*)data, length)) != NULL)
+		return ccache_hit(self, e, target);
+	cbuf_init(&t, data, length);
+	return ccache_miss(self, hash, &t, target);
+}
+
+static int ccache_equal(cbufs_t* bufs, ssize_t start, ssize_t n, const char* p) {
+	cbufs_cursor_t cursor;
+	cx_buf_t span;
+
+	cbufs_cursor_init(&cursor, bufs, start);
+	while (n > 0 && cbufs_cursor_next(&cursor, n, &span) > 0) {
+		if (memcmp(span.base, p, span.len) != 0)
+			return 0;
+		p += span.len;
+		n -= span.len;
+	}
+	return 1;
+}
+
+// as ccache_put, reading a range of a chain without linearising it
+int ccache_put_bufs(ccache_t* self, cbufs_t* bufs, ssize_t start, ssize_t n, cbuf_t* target) {
+	uint64_t hash;
+	struct ccache_entry_s* e;
+	cbufs_cursor_t cursor;
+	cbuf_t t;
+
+	cbufs_cursor_init(&cursor, bufs, start);
+	if (n < 0 || n > cbufs_cursor_remain(&cursor))
+		n = cbufs_cursor_remain(&cursor);
+	if (n == 0) {
+		ccache_empty(target);
+		return 0;
+	}
+
+	hash = cbufs_xxh64(bufs, start, n, CCACHE_SEED);
+	for (e = self->slots[hash & (self->nslots - 1)]; e; e = e->next) {
+		if (e->hash == hash && cbuf_length(&e->buf) == n &&
+			ccache_equal(bufs, start, n, cbuf_base(&e->buf)))
+			return ccache_hit(self, e, target);
+	}
+
+	cbufs_cursor_read(&cursor, n, cbuf_init2(&t, n));
+	return ccache_miss(self, hash, &t, target);
+}
+
+// looks a payload up by its xxh64 content hash
+int ccache_get(ccache_t* self, uint64_t hash, cbuf_t* target) {
+	struct ccache_entry_s* e;
+
+	for (e = self->slots[hash & (self->nslots - 1)]; e; e = e->next) {
+		if (e->hash == hash)
+			return ccache_hit(self, e, target);
+	}
+	return 0;
+}
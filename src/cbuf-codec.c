@@ -0,0 +1,401 @@
+#include <string.h>
+
+#include "cbuf.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define CCODEC_X86
+# include <immintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+# include <pthread.h>
+# define CCODEC_ONCE
+#endif
+
+// output written per reserve, in input units
+#define CCODEC_SLICE 16384
+// SIMD stores may run this far past the last valid output byte
+#define CCODEC_SLACK 16
+
+static const char ccodec_b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char ccodec_hex[] = "0123456789abcdef";
+
+// decoded value of each byte, -1 for invalid, -2 for '='
+static signed char ccodec_b64_values[256];
+static signed char ccodec_hex_values[256];
+static int ccodec_simd = 0;
+
+static void ccodec_setup(void) {
+	int i;
+
+	for (i = 0; i < 256; ++i) {
+		ccodec_b64_values[i] = -1;
+		ccodec_hex_values[i] = -1;
+	}
+	for (i = 0; i < 64; ++i)
+		ccodec_b64_values[(unsigned char)ccodec_b64[i]] = (signed char)i;
+	ccodec_b64_values['='] = -2;
+	for (i = 0; i < 16; ++i) {
+		ccodec_hex_values[(unsigned char)ccodec_hex[i]] = (signed char)i;
+		ccodec_hex_values[(unsigned char)"0123456789ABCDEF"[i]] = (signed char)i;
+	}
+
+#ifdef CCODEC_X86
+	__builtin_cpu_init();
+	ccodec_simd = __builtin_cpu_supports("ssse3") ? 1 : 0;
+#else
+	ccodec_simd = 0;
+#endif
+}
+
+// the tables are shared by every thread, so they are filled exactly once
+#ifdef CCODEC_ONCE
+static pthread_once_t ccodec_once = PTHREAD_ONCE_INIT;
+# define CCODEC_SETUP() pthread_once(&ccodec_once, ccodec_setup)
+#else
+static int ccodec_ready = 0;
+# define CCODEC_SETUP() do { if (!ccodec_ready) { ccodec_setup(); ccodec_ready = 1; } } while (0)
+#endif
+
+#ifdef CCODEC_X86
+// 12 input bytes to 16 characters per step, reads 16 input bytes
+__attribute__((target("ssse3")))
+static ssize_t ccodec_b64_encode_ssse3(const unsigned char* in, ssize_t units, unsigned char* out) {
+	const __m128i shuf = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	const __m128i shift = _mm_setr_epi8(
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+	ssize_t done = 0;
+
+	while (units - done >= 6) {
+		__m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)in), shuf);
+		__m128i t0 = _mm_mulhi_epu16(_mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+		__m128i t1 = _mm_mullo_epi16(_mm_and_si128(v, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+		__m128i idx = _mm_or_si128(t0, t1);
+		__m128i r = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+		r = _mm_or_si128(r, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), idx), _mm_set1_epi8(13)));
+		r = _mm_add_epi8(_mm_shuffle_epi8(shift, r), idx);
+		_mm_storeu_si128((__m128i*)out, r);
+		in += 12;
+		out += 16;
+		done += 4;
+	}
+
+	return done;
+}
+
+// 16 characters to 12 bytes per step, stops at the first block holding
+// anything but the 64 alphabet characters
+__attribute__((target("ssse3")))
+static ssize_t ccodec_b64_decode_ssse3(const unsigned char* in, ssize_t units, unsigned char* out) {
+	const __m128i lut_lo = _mm_setr_epi8(
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+		0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const __m128i lut_hi = _mm_setr_epi8(
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	const __m128i mask_2f = _mm_set1_epi8(0x2f);
+	ssize_t done = 0;
+
+	while (units - done >= 4) {
+		__m128i v = _mm_loadu_si128((const __m128i*)in);
+		__m128i hi = _mm_and_si128(_mm_srli_epi32(v, 4), mask_2f);
+		__m128i lo = _mm_and_si128(v, mask_2f);
+		__m128i bad = _mm_and_si128(_mm_shuffle_epi8(lut_lo, lo), _mm_shuffle_epi8(lut_hi, hi));
+		__m128i roll;
+		if (_mm_movemask_epi8(_mm_cmpgt_epi8(bad, _mm_setzero_si128())) != 0)
+			break;
+		roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(v, mask_2f), hi));
+		v = _mm_add_epi8(v, roll);
+		v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+		v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+		_mm_storeu_si128((__m128i*)out, _mm_shuffle_epi8(v, pack));
+		in += 16;
+		out += 12;
+		done += 4;
+	}
+
+	return done;
+}
+
+__attribute__((target("ssse3")))
+static ssize_t ccodec_hex_encode_ssse3(const unsigned char* in, ssize_t units, unsigned char* out) {
+	const __m128i lut = _mm_loadu_si128((const __m128i*)ccodec_hex);
+	const __m128i low4 = _mm_set1_epi8(0x0f);
+	ssize_t done = 0;
+
+	while (units - done >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)in);
+		__m128i hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(v, 4), low4));
+		__m128i lo = _mm_shuffle_epi8(lut, _mm_and_si128(v, low4));
+		_mm_storeu_si128((__m128i*)out, _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i*)(out + 16), _mm_unpackhi_epi8(hi, lo));
+		in += 16;
+		out += 32;
+		done += 16;
+	}
+
+	return done;
+}
+
+static inline __m128i ccodec_hex_nibbles(__m128i v, __m128i* valid) __attribute__((target("ssse3")));
+static inline __m128i ccodec_hex_nibbles(__m128i v, __m128i* valid) {
+	__m128i d = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+	__m128i l = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+	__m128i dv = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+	__m128i lv = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8(5)), l);
+	*valid = _mm_or_si128(dv, lv);
+	return _mm_or_si128(_mm_and_si128(dv, d), _mm_and_si128(lv, _mm_add_epi8(l, _mm_set1_epi8(10))));
+}
+
+// 32 characters to 16 bytes per step, stops at the first invalid block
+__attribute__((target("ssse3")))
+static ssize_t ccodec_hex_decode_ssse3(const unsigned char* in, ssize_t units, unsigned char* out) {
+	const __m128i weights = _mm_set1_epi16(0x0110);
+	ssize_t done = 0;
+
+	while (units - done >= 16) {
+		__m128i va, vb;
+		__m128i a = ccodec_hex_nibbles(_mm_loadu_si128((const __m128i*)in), &va);
+		__m128i b = ccodec_hex_nibbles(_mm_loadu_si128((const __m128i*)(in + 16)), &vb);
+		if (_mm_movemask_epi8(_mm_and_si128(va, vb)) != 0xffff)
+			break;
+		a = _mm_maddubs_epi16(a, weights);
+		b = _mm_maddubs_epi16(b, weights);
+		_mm_storeu_si128((__m128i*)out, _mm_packus_epi16(a, b));
+		in += 32;
+		out += 16;
+		done += 16;
+	}
+
+	return done;
+}
+#endif
+
+static ssize_t ccodec_b64_encode(ccodec_t* self, const unsigned char* in, ssize_t units, unsigned char* out) {
+	ssize_t i = 0;
+
+	(void)self;
+#ifdef CCODEC_X86
+	if (ccodec_simd)
+		i = ccodec_b64_encode_ssse3(in, units, out);
+#endif
+	for (in += i * 3, out += i * 4; i < units; ++i, in += 3, out += 4) {
+		unsigned v = (in[0] << 16) | (in[1] << 8) | in[2];
+		out[0] = ccodec_b64[v >> 18];
+		out[1] = ccodec_b64[(v >> 12) & 63];
+		out[2] = ccodec_b64[(v >> 6) & 63];
+		out[3] = ccodec_b64[v & 63];
+	}
+
+	return units * 4;
+}
+
+static ssize_t ccodec_b64_decode(ccodec_t* self, const unsigned char* in, ssize_t units, unsigned char* out) {
+	unsigned char* o = out;
+	ssize_t i = 0;
+
+	if (self->state != 0)
+		return -1;
+#ifdef CCODEC_X86
+	if (ccodec_simd) {
+		i = ccodec_b64_decode_ssse3(in, units, out);
+		in += i * 4;
+		o += i * 3;
+	}
+#endif
+	for (; i < units; ++i, in += 4) {
+		int a = ccodec_b64_values[in[0]];
+		int b = ccodec_b64_values[in[1]];
+		int c = ccodec_b64_values[in[2]];
+		int d = ccodec_b64_values[in[3]];
+		if (a < 0 || b < 0 || c == -1 || d == -1)
+			return -1;
+		if (c == -2 || d == -2) {
+			// padding only ends the very last unit
+			if ((c == -2 && d != -2) || i + 1 < units)
+				return -1;
+			*(o++) = (unsigned char)((a << 2) | (b >> 4));
+			if (c != -2)
+				*(o++) = (unsigned char)((b << 4) | (c >> 2));
+			self->state = 1;
+			break;
+		}
+		*(o++) = (unsigned char)((a << 2) | (b >> 4));
+		*(o++) = (unsigned char)((b << 4) | (c >> 2));
+		*(o++) = (unsigned char)((c << 6) | d);
+	}
+
+	return o - out;
+}
+
+static ssize_t ccodec_hex_encode(ccodec_t* self, const unsigned char* in, ssize_t units, unsigned char* out) {
+	ssize_t i = 0;
+
+	(void)self;
+#ifdef CCODEC_X86
+	if (ccodec_simd)
+		i = ccodec_hex_encode_ssse3(in, units, out);
+#endif
+	for (; i < units; ++i) {
+		out[i * 2] = ccodec_hex[in[i] >> 4];
+		out[i * 2 + 1] = ccodec_hex[in[i] & 15];
+	}
+
+	return units * 2;
+}
+
+static ssize_t ccodec_hex_decode(ccodec_t* self, const unsigned char* in, ssize_t units, unsigned char* out) {
+	ssize_t i = 0;
+
+	(void)self;
+#ifdef CCODEC_X86
+	if (ccodec_simd)
+		i = ccodec_hex_decode_ssse3(in, units, out);
+#endif
+	for (; i < units; ++i) {
+		int hi = ccodec_hex_values[in[i * 2]];
+		int lo = ccodec_hex_values[in[i * 2 + 1]];
+		if (hi < 0 || lo < 0)
+			return -1;
+		out[i] = (unsigned char)((hi << 4) | lo);
+	}
+
+	return units;
+}
+
+typedef ssize_t (*ccodec_fn)(ccodec_t* self, const unsigned char* in, ssize_t units, unsigned char* out);
+
+static const struct {
+	int in;
+	int out;
+	ccodec_fn fn;
+} ccodec_kinds[] = {
+	{ 0, 0, NULL },
+	{ 3, 4, ccodec_b64_encode },
+	{ 4, 3, ccodec_b64_decode },
+	{ 1, 2, ccodec_hex_encode },
+	{ 2, 1, ccodec_hex_decode },
+};
+
+ccodec_t* ccodec_init(ccodec_t* self, int kind) {
+	CCODEC_SETUP();
+	self->kind = kind;
+	self->state = 0;
+	self->ncarry = 0;
+	return self;
+}
+
+static int ccodec_run(ccodec_t* self, const unsigned char* in, ssize_t units, cbuilder_t* target) {
+	int unit = ccodec_kinds[self->kind].in;
+	int ratio = ccodec_kinds[self->kind].out;
+
+	while (units > 0) {
+		ssize_t n = units < CCODEC_SLICE ? units : CCODEC_SLICE;
+		unsigned char* out = (unsigned char*)cbuilder_reserve(target, n * ratio + CCODEC_SLACK);
+		ssize_t w = ccodec_kinds[self->kind].fn(self, in, n, out);
+		if (w < 0) {
+			self->state = -1;
+			return -1;
+		}
+		cbuilder_commit(target, w);
+		in += n * unit;
+		units -= n;
+	}
+
+	return 0;
+}
+
+int ccodec_update(ccodec_t* self, const void* data, ssize_t length, cbuilder_t* target) {
+	const unsigned char* p = (const unsigned char*)data;
+	int unit = ccodec_kinds[self->kind].in;
+	ssize_t units;
+
+	if (self->state < 0)
+		return -1;
+
+	// complete a unit left over from the previous segment first
+	while (self->ncarry > 0 && length > 0) {
+		self->carry[self->ncarry++] = *(p++);
+		--length;
+		if (self->ncarry == unit) {
+			self->ncarry = 0;
+			if (ccodec_run(self, self->carry, 1, target) != 0)
+				return -1;
+		}
+	}
+
+	units = length / unit;
+	if (units > 0 && ccodec_run(self, p, units, target) != 0)
+		return -1;
+	p += units * unit;
+	length -= units * unit;
+	memcpy(self->carry + self->ncarry, p, length);
+	self->ncarry += (int)length;
+	return 0;
+}
+
+int ccodec_finish(ccodec_t* self, cbuilder_t* target) {
+	unsigned char* p = self->carry;
+	unsigned char* out;
+
+	if (self->state < 0)
+		return -1;
+	if (self->ncarry == 0)
+		return 0;
+
+	switch (self->kind) {
+	case CCODEC_BASE64_ENCODE:
+		{
+			unsigned v = (p[0] << 16) | (self->ncarry > 1 ? p[1] << 8 : 0);
+			out = (unsigned char*)cbuilder_reserve(target, 4);
+			out[0] = ccodec_b64[v >> 18];
+			out[1] = ccodec_b64[(v >> 12) & 63];
+			out[2] = self->ncarry > 1 ? ccodec_b64[(v >> 6) & 63] : '=';
+			out[3] = '=';
+			cbuilder_commit(target, 4);
+		}
+		break;
+	case CCODEC_BASE64_DECODE:
+		// unpadded input, 2 or 3 characters still make whole bytes
+		if (self->state != 0 || self->ncarry == 1)
+			goto fail;
+		p[3] = '=';
+		if (self->ncarry == 2)
+			p[2] = '=';
+		self->ncarry = 0;
+		return ccodec_run(self, p, 1, target);
+	default:
+		goto fail;
+	}
+
+	self->ncarry = 0;
+	return 0;
+
+fail:
+	self->state = -1;
+	return -1;
+}
+
+ssize_t cbufs_transcode(cbufs_t* self, ssize_t start, ssize_t n, int kind, cbuilder_t* target) {
+	ssize_t before = cbuilder_length(target);
+	cbufs_cursor_t cursor;
+	ccodec_t codec;
+	cx_buf_t span;
+
+	ccodec_init(&codec, kind);
+	cbufs_cursor_init(&cursor, self, start);
+	if (n < 0 || n > cbufs_cursor_remain(&cursor))
+		n = cbufs_cursor_remain(&cursor);
+	while (n > 0 && cbufs_cursor_next(&cursor, n, &span) > 0) {
+		if (ccodec_update(&codec, span.base, span.len, target) != 0)
+			return -1;
+		n -= span.len;
+	}
+
+	if (ccodec_finish(&codec, target) != 0)
+		return -1;
+	return cbuilder_length(target) - before;
+}
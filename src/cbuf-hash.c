@@ -0,0 +1,477 @@
+#include <string.h>
+
+#include "cbuf.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+# include <pthread.h>
+# define CHASH_THREADS
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define CHASH_X86
+# include <immintrin.h>
+#endif
+
+// reflected Castagnoli polynomial
+#define CCRC32C_POLY 0x82f63b78u
+
+static uint32_t ccrc32c_table[8][256];
+// x^(2^k) mod p, used to shift a crc over 2^k zero bits
+static uint32_t ccrc32c_x2n[32];
+static int ccrc32c_simd = 0;
+
+static inline uint32_t ccrc32c_mult(uint32_t a, uint32_t b) {
+	uint32_t m = 1u << 31;
+	uint32_t p = 0;
+
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		m >>= 1;
+		b = (b & 1) ? (b >> 1) ^ CCRC32C_POLY : b >> 1;
+	}
+	return p;
+}
+
+static void ccrc32c_setup(void) {
+	uint32_t c, p;
+	int i, k;
+
+	for (i = 0; i < 256; ++i) {
+		c = (uint32_t)i;
+		for (k = 0; k < 8; ++k)
+			c = (c & 1) ? (c >> 1) ^ CCRC32C_POLY : c >> 1;
+		ccrc32c_table[0][i] = c;
+	}
+	for (i = 0; i < 256; ++i) {
+		c = ccrc32c_table[0][i];
+		for (k = 1; k < 8; ++k) {
+			c = ccrc32c_table[0][c & 0xff] ^ (c >> 8);
+			ccrc32c_table[k][i] = c;
+		}
+	}
+
+	p = 1u << 30;
+	ccrc32c_x2n[0] = p;
+	for (k = 1; k < 32; ++k)
+		ccrc32c_x2n[k] = p = ccrc32c_mult(p, p);
+
+#ifdef CHASH_X86
+	__builtin_cpu_init();
+	ccrc32c_simd = __builtin_cpu_supports("sse4.2") ? 1 : 0;
+#else
+	ccrc32c_simd = 0;
+#endif
+}
+
+// hash workers and callers share the tables, they are built exactly once
+#ifdef CHASH_THREADS
+static pthread_once_t ccrc32c_once = PTHREAD_ONCE_INIT;
+# define CCRC32C_SETUP() pthread_once(&ccrc32c_once, ccrc32c_setup)
+#else
+static int ccrc32c_ready = 0;
+# define CCRC32C_SETUP() do { if (!ccrc32c_ready) { ccrc32c_setup(); ccrc32c_ready = 1; } } while (0)
+#endif
+
+// slicing-by-8, c is the raw (inverted) register
+static uint32_t ccrc32c_sw(uint32_t c, const unsigned char* p, ssize_t n) {
+	while (n > 0 && ((uintptr_t)p & 7) != 0) {
+		c = ccrc32c_table[0][(c ^ *p++) & 0xff] ^ (c >> 8);
+		--n;
+	}
+	for (; n >= 8; n -= 8, p += 8) {
+		uint32_t lo, hi;
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + 4, 4);
+#ifdef CX_IS_BIG_ENDIAN
+		lo = __builtin_bswap32(lo);
+		hi = __builtin_bswap32(hi);
+#endif
+		lo ^= c;
+		c = ccrc32c_table[7][lo & 0xff] ^ ccrc32c_table[6][(lo >> 8) & 0xff] ^
+			ccrc32c_table[5][(lo >> 16) & 0xff] ^ ccrc32c_table[4][lo >> 24] ^
+			ccrc32c_table[3][hi & 0xff] ^ ccrc32c_table[2][(hi >> 8) & 0xff] ^
+			ccrc32c_table[1][(hi >> 16) & 0xff] ^ ccrc32c_table[0][hi >> 24];
+	}
+	while (n-- > 0)
+		c = ccrc32c_table[0][(c ^ *p++) & 0xff] ^ (c >> 8);
+	return c;
+}
+
+#ifdef CHASH_X86
+__attribute__((target("sse4.2")))
+static uint32_t ccrc32c_hw(uint32_t c, const unsigned char* p, ssize_t n) {
+	while (n > 0 && ((uintptr_t)p & 7) != 0) {
+		c = _mm_crc32_u8(c, *p++);
+		--n;
+	}
+#ifdef __x86_64__
+	{
+		uint64_t c64 = c;
+		for (; n >= 32; n -= 32, p += 32) {
+			c64 = _mm_crc32_u64(c64, *(const uint64_t*)p);
+			c64 = _mm_crc32_u64(c64, *(const uint64_t*)(p + 8));
+			c64 = _mm_crc32_u64(c64, *(const uint64_t*)(p + 16));
+			c64 = _mm_crc32_u64(c64, *(const uint64_t*)(p + 24));
+		}
+		for (; n >= 8; n -= 8, p += 8)
+			c64 = _mm_crc32_u64(c64, *(const uint64_t*)p);
+		c = (uint32_t)c64;
+	}
+#endif
+	for (; n >= 4; n -= 4, p += 4)
+		c = _mm_crc32_u32(c, *(const uint32_t*)p);
+	while (n-- > 0)
+		c = _mm_crc32_u8(c, *p++);
+	return c;
+}
+#endif
+
+uint32_t ccrc32c_update(uint32_t crc, const void* data, ssize_t length) {
+	uint32_t c = ~crc;
+
+	CCRC32C_SETUP();
+#ifdef CHASH_X86
+	if (ccrc32c_simd)
+		return ~ccrc32c_hw(c, (const unsigned char*)data, length);
+#endif
+	return ~ccrc32c_sw(c, (const unsigned char*)data, length);
+}
+
+// crc of A..B from crc(A), crc(B) and the length of B, in O(log length2)
+uint32_t ccrc32c_combine(uint32_t crc1, uint32_t crc2, ssize_t length2) {
+	uint32_t p = 1u << 31;
+	int k = 3;
+
+	CCRC32C_SETUP();
+	for (; length2 > 0; length2 >>= 1, ++k) {
+		if (length2 & 1)
+			p = ccrc32c_mult(ccrc32c_x2n[k & 31], p);
+	}
+	return ccrc32c_mult(p, crc1) ^ crc2;
+}
+
+static uint32_t ccrc32c_cursor(cbufs_cursor_t* cursor, ssize_t n, uint32_t crc) {
+	cx_buf_t span;
+
+	while (n > 0 && cbufs_cursor_next(cursor, n, &span) > 0) {
+		crc = ccrc32c_update(crc, span.base, span.len);
+		n -= span.len;
+	}
+	return crc;
+}
+
+#ifdef CHASH_THREADS
+
+#define CHASH_MAX_THREADS 64
+#define CHASH_MAX_TASKS 128
+// smallest range worth handing to another thread
+#define CHASH_TASK_MIN ((ssize_t)1 << 20)
+
+struct chash_task_s {
+	cbufs_cursor_t cursor;
+	ssize_t length;
+	uint32_t crc;
+};
+
+// lives on the caller's stack, which also runs tasks until none are left
+struct chash_job_s {
+	struct chash_job_s* next;
+	struct chash_task_s* tasks;
+	int ntasks;
+	int claimed;
+	int done;
+};
+
+static pthread_mutex_t chash_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t chash_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t chash_done = PTHREAD_COND_INITIALIZER;
+static struct chash_job_s* chash_jobs = NULL;
+static int chash_started = 0;
+static volatile int chash_threads = 0;
+static volatile ssize_t chash_min_size = (ssize_t)16 << 20;
+
+// called with chash_lock held, returns with it held
+static void chash_run(struct chash_job_s* job) {
+	struct chash_task_s* t = job->tasks + job->claimed++;
+
+	if (job->claimed == job->ntasks) {
+		struct chash_job_s** pp = &chash_jobs;
+		while (*pp != job)
+			pp = &(*pp)->next;
+		*pp = job->next;
+	}
+	pthread_mutex_unlock(&chash_lock);
+	t->crc = ccrc32c_cursor(&t->cursor, t->length, 0);
+	pthread_mutex_lock(&chash_lock);
+	if (++job->done == job->ntasks)
+		pthread_cond_broadcast(&chash_done);
+}
+
+static void* chash_worker(void* arg) {
+	(void)arg;
+	pthread_mutex_lock(&chash_lock);
+	for (;;) {
+		while (chash_jobs == NULL)
+			pthread_cond_wait(&chash_wake, &chash_lock);
+		chash_run(chash_jobs);
+	}
+	return NULL;
+}
+
+int chash_configure(int threads, ssize_t min_size) {
+	int r = 0;
+
+	if (threads < 0)
+		threads = 0;
+	if (threads > CHASH_MAX_THREADS)
+		threads = CHASH_MAX_THREADS;
+	pthread_mutex_lock(&chash_lock);
+	// workers are never torn down, a smaller count only splits each range
+	// into fewer tasks, every started worker still picks them up
+	while (chash_started < threads) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, chash_worker, NULL) != 0) {
+			r = -1;
+			break;
+		}
+		pthread_detach(thread);
+		++chash_started;
+	}
+	chash_threads = chash_started < threads ? chash_started : threads;
+	if (min_size > 0)
+		chash_min_size = min_size < CHASH_TASK_MIN ? CHASH_TASK_MIN : min_size;
+	pthread_mutex_unlock(&chash_lock);
+	return r;
+}
+
+int chash_get_threads(ssize_t* min_size) {
+	if (min_size)
+		*min_size = chash_min_size;
+	return chash_threads;
+}
+
+static uint32_t ccrc32c_parallel(cbufs_cursor_t* cursor, ssize_t n, uint32_t crc, int threads) {
+	struct chash_task_s tasks[CHASH_MAX_TASKS];
+	struct chash_job_s job;
+	ssize_t size;
+	int i, ntasks;
+
+	// a few tasks per participant evens out uneven progress
+	ntasks = (threads + 1) * 4;
+	if (ntasks > CHASH_MAX_TASKS)
+		ntasks = CHASH_MAX_TASKS;
+	if (n / ntasks < CHASH_TASK_MIN)
+		ntasks = (int)(n / CHASH_TASK_MIN);
+	size = n / ntasks;
+	for (i = 0; i < ntasks; ++i) {
+		tasks[i].cursor = *cursor;
+		tasks[i].length = (i == ntasks - 1) ? n - size * i : size;
+		cbufs_cursor_skip(cursor, tasks[i].length);
+	}
+
+	job.next = NULL;
+	job.tasks = tasks;
+	job.ntasks = ntasks;
+	job.claimed = 0;
+	job.done = 0;
+	pthread_mutex_lock(&chash_lock);
+	{
+		struct chash_job_s** pp = &chash_jobs;
+		while (*pp)
+			pp = &(*pp)->next;
+		*pp = &job;
+	}
+	pthread_cond_broadcast(&chash_wake);
+	while (job.claimed < job.ntasks)
+		chash_run(&job);
+	while (job.done < job.ntasks)
+		pthread_cond_wait(&chash_done, &chash_lock);
+	pthread_mutex_unlock(&chash_lock);
+
+	for (i = 0; i < ntasks; ++i)
+		crc = ccrc32c_combine(crc, tasks[i].crc, tasks[i].length);
+	return crc;
+}
+
+#else
+
+int chash_configure(int threads, ssize_t min_size) {
+	(void)min_size;
+	return threads > 0 ? -1 : 0;
+}
+
+int chash_get_threads(ssize_t* min_size) {
+	if (min_size)
+		*min_size = 0;
+	return 0;
+}
+
+#endif
+
+// ranges of at least the configured minimum are split across the worker
+// pool, the partial crcs combine to exactly the sequential result
+uint32_t cbufs_crc32c(cbufs_t* self, ssize_t start, ssize_t n, uint32_t crc) {
+	cbufs_cursor_t cursor;
+
+	cbufs_cursor_init(&cursor, self, start);
+	if (n < 0 || n > cbufs_cursor_remain(&cursor))
+		n = cbufs_cursor_remain(&cursor);
+#ifdef CHASH_THREADS
+	{
+		int threads = chash_threads;
+		if (threads > 0 && n >= chash_min_size)
+			return ccrc32c_parallel(&cursor, n, crc, threads);
+	}
+#endif
+	return ccrc32c_cursor(&cursor, n, crc);
+}
+
+#define CXXH_P1 0x9e3779b185ebca87ull
+#define CXXH_P2 0xc2b2ae3d27d4eb4full
+#define CXXH_P3 0x165667b19e3779f9ull
+#define CXXH_P4 0x85ebca77c2b2ae63ull
+#define CXXH_P5 0x27d4eb2f165667c5ull
+
+static inline uint64_t cxxh_rotl(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t cxxh_read64(const unsigned char* p) {
+	uint64_t v;
+	memcpy(&v, p, 8);
+#ifdef CX_IS_BIG_ENDIAN
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+static inline uint32_t cxxh_read32(const unsigned char* p) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+#ifdef CX_IS_BIG_ENDIAN
+	v = __builtin_bswap32(v);
+#endif
+	return v;
+}
+
+static inline uint64_t cxxh_round(uint64_t acc, uint64_t input) {
+	acc += input * CXXH_P2;
+	acc = cxxh_rotl(acc, 31);
+	return acc * CXXH_P1;
+}
+
+static inline uint64_t cxxh_merge(uint64_t acc, uint64_t v) {
+	acc ^= cxxh_round(0, v);
+	return acc * CXXH_P1 + CXXH_P4;
+}
+
+cxxh64_t* cxxh64_init(cxxh64_t* self, uint64_t seed) {
+	self->total = 0;
+	self->v[0] = seed + CXXH_P1 + CXXH_P2;
+	self->v[1] = seed + CXXH_P2;
+	self->v[2] = seed;
+	self->v[3] = seed - CXXH_P1;
+	self->seed = seed;
+	self->nmem = 0;
+	return self;
+}
+
+void cxxh64_update(cxxh64_t* self, const void* data, ssize_t length) {
+	const unsigned char* p = (const unsigned char*)data;
+	const unsigned char* e = p + length;
+
+	self->total += (uint64_t)length;
+	if (self->nmem + length < 32) {
+		memcpy(self->mem + self->nmem, p, length);
+		self->nmem += (unsigned)length;
+		return;
+	}
+	if (self->nmem > 0) {
+		unsigned fill = 32 - self->nmem;
+		memcpy(self->mem + self->nmem, p, fill);
+		self->v[0] = cxxh_round(self->v[0], cxxh_read64(self->mem));
+		self->v[1] = cxxh_round(self->v[1], cxxh_read64(self->mem + 8));
+		self->v[2] = cxxh_round(self->v[2], cxxh_read64(self->mem + 16));
+		self->v[3] = cxxh_round(self->v[3], cxxh_read64(self->mem + 24));
+		p += fill;
+		self->nmem = 0;
+	}
+	if (e - p >= 32) {
+		uint64_t v0 = self->v[0], v1 = self->v[1], v2 = self->v[2], v3 = self->v[3];
+		do {
+			v0 = cxxh_round(v0, cxxh_read64(p));
+			v1 = cxxh_round(v1, cxxh_read64(p + 8));
+			v2 = cxxh_round(v2, cxxh_read64(p + 16));
+			v3 = cxxh_round(v3, cxxh_read64(p + 24));
+			p += 32;
+		} while (e - p >= 32);
+		self->v[0] = v0;
+		self->v[1] = v1;
+		self->v[2] = v2;
+		self->v[3] = v3;
+	}
+	if (p < e) {
+		memcpy(self->mem, p, e - p);
+		self->nmem = (unsigned)(e - p);
+	}
+}
+
+// does not modify the state, more data may follow
+uint64_t cxxh64_digest(const cxxh64_t* self) {
+	const unsigned char* p = self->mem;
+	const unsigned char* e = p + self->nmem;
+	uint64_t h;
+
+	if (self->total >= 32) {
+		h = cxxh_rotl(self->v[0], 1) + cxxh_rotl(self->v[1], 7) +
+			cxxh_rotl(self->v[2], 12) + cxxh_rotl(self->v[3], 18);
+		h = cxxh_merge(h, self->v[0]);
+		h = cxxh_merge(h, self->v[1]);
+		h = cxxh_merge(h, self->v[2]);
+		h = cxxh_merge(h, self->v[3]);
+	} else {
+		h = self->seed + CXXH_P5;
+	}
+	h += self->total;
+
+	for (; e - p >= 8; p += 8) {
+		h ^= cxxh_round(0, cxxh_read64(p));
+		h = cxxh_rotl(h, 27) * CXXH_P1 + CXXH_P4;
+	}
+	if (e - p >= 4) {
+		h ^= (uint64_t)cxxh_read32(p) * CXXH_P1;
+		h = cxxh_rotl(h, 23) * CXXH_P2 + CXXH_P3;
+		p += 4;
+	}
+	for (; p < e; ++p) {
+		h ^= (uint64_t)*p * CXXH_P5;
+		h = cxxh_rotl(h, 11) * CXXH_P1;
+	}
+
+	h ^= h >> 33;
+	h *= CXXH_P2;
+	h ^= h >> 29;
+	h *= CXXH_P3;
+	h ^= h >> 32;
+	return h;
+}
+
+uint64_t cbufs_xxh64(cbufs_t* self, ssize_t start, ssize_t n, uint64_t seed) {
+	cbufs_cursor_t cursor;
+	cx_buf_t span;
+	cxxh64_t h;
+
+	cxxh64_init(&h, seed);
+	cbufs_cursor_init(&cursor, self, start);
+	if (n < 0 || n > cbufs_cursor_remain(&cursor))
+		n = cbufs_cursor_remain(&cursor);
+	while (n > 0 && cbufs_cursor_next(&cursor, n, &span) > 0) {
+		cxxh64_update(&h, span.base, span.len);
+		n -= span.len;
+	}
+	return cxxh64_digest(&h);
+}
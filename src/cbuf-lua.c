@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <memory.h>
 #include <lauxlib.h>
@@ -9,7 +10,16 @@
 
 #define L_BUF_META "cbuf.buf"
 #define L_BUFS_META "cbuf.bufs"
+#define L_BUILDER_META "cbuf.builder"
+#define L_DECODER_META "cbuf.decoder"
+#define L_ARRAY_META "cbuf.array"
+#define L_UTF8_META "cbuf.utf8"
+#define L_XXH64_META "cbuf.xxh64"
+#define L_LZ_META "cbuf.lz"
+#define L_CACHE_META "cbuf.cache"
 #define L_STRUCT_META "cbuf.struct"
+#define L_STRUCT_CACHE "cbuf.struct.cache"
+#define L_ROOT_BUDGET "cbuf.budget"
 
 enum {
 	CSTRUCT_OP_PADDING = 1,
@@ -35,10 +45,45 @@ enum {
 	CSTRUCT_OP_SW_UINT64,
 	CSTRUCT_OP_SW_FLOAT32,
 	CSTRUCT_OP_SW_FLOAT64,
+	CSTRUCT_OP_ARRAY,
+	CSTRUCT_OP_DARRAY,
 };
 
-static int L_struct_new(lua_State* L) {
-	const char* fp = luaL_checkstring(L, 1);
+// scalar op with the byte swap stripped
+static int L_struct_base(int op) {
+	return op >= CSTRUCT_OP_SW_INT16 ? op - (CSTRUCT_OP_SW_INT16 - CSTRUCT_OP_INT16) : op;
+}
+
+static int L_struct_width(int op) {
+	switch (L_struct_base(op)) {
+	case CSTRUCT_OP_INT8:
+	case CSTRUCT_OP_UINT8:
+		return 1;
+	case CSTRUCT_OP_INT16:
+	case CSTRUCT_OP_UINT16:
+		return 2;
+	case CSTRUCT_OP_INT32:
+	case CSTRUCT_OP_UINT32:
+	case CSTRUCT_OP_FLOAT32:
+		return 4;
+	default:
+		return 8;
+	}
+}
+
+// reads the decimal count starting at *ch, -1 once it no longer fits an int
+static int L_struct_rep(const char** fp, int* ch) {
+	int rep = 0;
+
+	do {
+		if (rep >= 0)
+			rep = (rep > (INT_MAX - (*ch - '0')) / 10) ? -1 : rep * 10 + (*ch - '0');
+		*ch = *((*fp)++);
+	} while (*ch >= '0' && *ch <= '9');
+	return rep;
+}
+
+static int* L_struct_compile(lua_State* L, const char* fp) {
 	int* self = NULL;
 	int* data = NULL;
 	int length = 0;
@@ -61,14 +106,16 @@ static int L_struct_new(lua_State* L) {
 		switch (ch) {
 		case '@':
 			need_swap = 0;
-			break;
+			ch = *(fp++);
+			continue;
 		case '<':
 #ifdef CX_IS_BIG_ENDIAN
 			need_swap = 1;
 #else
 			need_swap = 0;
 #endif
-			break;
+			ch = *(fp++);
+			continue;
 		case '>':
 		case '!':
 #ifdef CX_IS_BIG_ENDIAN
@@ -76,7 +123,8 @@ static int L_struct_new(lua_State* L) {
 #else
 			need_swap = 1;
 #endif
-			break;
+			ch = *(fp++);
+			continue;
 		case 'x':
 			op = CSTRUCT_OP_PADDING;
 			rep = 1;
@@ -99,41 +147,42 @@ static int L_struct_new(lua_State* L) {
 			length += 1;
 			break;
 		case 'h':
-			op = need_swap ? CSTRUCT_OP_INT16 : CSTRUCT_OP_SW_INT16;
+			op = need_swap ? CSTRUCT_OP_SW_INT16 : CSTRUCT_OP_INT16;
 			length += 2;
 			break;
 		case 'H':
-			op = need_swap ? CSTRUCT_OP_UINT16 : CSTRUCT_OP_SW_UINT16;
+			op = need_swap ? CSTRUCT_OP_SW_UINT16 : CSTRUCT_OP_UINT16;
 			length += 2;
 			break;
 		case 'l':
-			op = need_swap ? CSTRUCT_OP_INT32 : CSTRUCT_OP_SW_INT32;
+			op = need_swap ? CSTRUCT_OP_SW_INT32 : CSTRUCT_OP_INT32;
 			length += 4;
 			break;
 		case 'L':
-			op = need_swap ? CSTRUCT_OP_UINT32 : CSTRUCT_OP_SW_UINT32;
+			op = need_swap ? CSTRUCT_OP_SW_UINT32 : CSTRUCT_OP_UINT32;
 			length += 4;
 			break;
 		case 'q':
-			op = need_swap ? CSTRUCT_OP_INT64 : CSTRUCT_OP_SW_INT64;
+			op = need_swap ? CSTRUCT_OP_SW_INT64 : CSTRUCT_OP_INT64;
 			length += 8;
 			break;
 		case 'Q':
-			op = need_swap ? CSTRUCT_OP_UINT64 : CSTRUCT_OP_SW_UINT64;
+			op = need_swap ? CSTRUCT_OP_SW_UINT64 : CSTRUCT_OP_UINT64;
 			length += 8;
 			break;
 		case 'f':
-			op = need_swap ? CSTRUCT_OP_FLOAT32 : CSTRUCT_OP_SW_FLOAT32;
+			op = need_swap ? CSTRUCT_OP_SW_FLOAT32 : CSTRUCT_OP_FLOAT32;
 			length += 4;
 			break;
 		case 'd':
-			op = need_swap ? CSTRUCT_OP_FLOAT64 : CSTRUCT_OP_SW_FLOAT64;
+			op = need_swap ? CSTRUCT_OP_SW_FLOAT64 : CSTRUCT_OP_FLOAT64;
 			length += 8;
 			break;
 		default:
 			if (data)
 				free(data);
-			return luaL_error(L, "Invalid format character: '%c'", ch);
+			luaL_error(L, "Invalid format character: '%c'", ch);
+			return NULL;
 		}
 
 		ch = *(fp++);
@@ -141,22 +190,44 @@ static int L_struct_new(lua_State* L) {
 		if (rep >= 0) {
 			if (ch == '#') {
 				PUSH(op + 1);
+				ch = *(fp++);
 			} else if (ch >= '1' && ch <= '9') {
 				PUSH(op);
-				rep = 0;
-				do {
-					rep = rep * 10 + (ch - '0');
-					ch = *(fp++);
-				} while (ch >= '0' && ch <= '9');
+				rep = L_struct_rep(&fp, &ch);
+				if (rep < 0 || rep > INT_MAX - length) {
+					if (data)
+						free(data);
+					luaL_error(L, "Repeat count too large");
+					return NULL;
+				}
 				PUSH(rep);
 				length += rep;
 			} else {
 				if (rep == 0) {
 					if (data)
 						free(data);
-					return luaL_error(L, "Invalid format character: near '%c'", ch);
+					luaL_error(L, "Invalid format character: near '%c'", ch);
+					return NULL;
 				}
 			}
+		} else if (ch == '#') {
+			// counted array, the count is an argument
+			PUSH(CSTRUCT_OP_DARRAY);
+			PUSH(op);
+			length -= L_struct_width(op);
+			ch = *(fp++);
+		} else if (ch >= '1' && ch <= '9') {
+			PUSH(CSTRUCT_OP_ARRAY);
+			PUSH(op);
+			rep = L_struct_rep(&fp, &ch);
+			if (rep < 0 || rep - 1 > (INT_MAX - length) / L_struct_width(op)) {
+				if (data)
+					free(data);
+				luaL_error(L, "Repeat count too large");
+				return NULL;
+			}
+			PUSH(rep);
+			length += L_struct_width(op) * (rep - 1);
 		} else {
 			PUSH(op);
 		}
@@ -166,11 +237,51 @@ static int L_struct_new(lua_State* L) {
 	self = (int*)lua_newuserdata(L, sizeof(int) * (n + 1));
 	self[0] = length;
 	memcpy(self + 1, data, sizeof(int) * n);
+	free(data);
 	luaL_setmetatable(L, L_STRUCT_META);
-	return 1;
+	return self;
 #undef PUSH
 };
 
+// descriptors are interned by format string and collected once unreferenced
+static int* L_struct_get(lua_State* L, int idx) {
+	int* self;
+
+	idx = lua_absindex(L, idx);
+	lua_getfield(L, LUA_REGISTRYINDEX, L_STRUCT_CACHE);
+	lua_pushvalue(L, idx);
+	lua_rawget(L, -2);
+	if (lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+		self = L_struct_compile(L, lua_tostring(L, idx));
+		lua_pushvalue(L, idx);
+		lua_pushvalue(L, -2);
+		lua_rawset(L, -4);
+	} else {
+		self = (int*)lua_touserdata(L, -1);
+	}
+
+	lua_remove(L, -2);
+	return self;
+}
+
+// accepts a compiled descriptor or a format string, which is replaced in place
+static int* L_checkstruct(lua_State* L, int idx) {
+	int* self;
+
+	if (lua_type(L, idx) != LUA_TSTRING)
+		return (int*)luaL_checkudata(L, idx, L_STRUCT_META);
+	self = L_struct_get(L, idx);
+	lua_replace(L, idx);
+	return self;
+}
+
+static int L_struct_new(lua_State* L) {
+	luaL_checkstring(L, 1);
+	L_struct_get(L, 1);
+	return 1;
+}
+
 static int L_struct_len(lua_State* L) {
 	int* self = (int*)luaL_checkudata(L, 1, L_STRUCT_META);
 	lua_pushinteger(L, self[0]);
@@ -215,9 +326,9 @@ static int L_buf_base(lua_State* L) {
 
 static int L_buf_slice(lua_State* L) {
 	cbuf_t* self = (cbuf_t*)luaL_checkudata(L, 1, L_BUF_META);
-	int length = self->end - self->start;
-	int start = luaL_optint(L, 1, 0);
-	int end = luaL_optint(L, 2, length);
+	ssize_t length = self->end - self->start;
+	ssize_t start = luaL_optinteger(L, 2, 0);
+	ssize_t end = luaL_optinteger(L, 3, length);
 	if (start == 0 && end == length) {
 		lua_settop(L, 1);
 	} else {
@@ -229,25 +340,30 @@ static int L_buf_slice(lua_State* L) {
 	return 1;
 }
 
-static int L_buf_tostring(lua_State* L) {
-	cbuf_t* self = (cbuf_t*)luaL_checkudata(L, 1, L_BUF_META);
-	const char* s = cbuf_base(self);
-	ssize_t len = cbuf_length(self);
-	int start = luaL_optint(L, 2, 0);
-	int n = luaL_optint(L, 3, -1);
-	if (start < 0)
-		start += len;
-	if (start >= 0 && start < len) {
-		if (n < 0)
-			n = len - start;
-		if (n > 0) {
-			lua_pushlstring(L, s + start, n);
-			return 1;
-		}
-	}
+typedef struct {
+	cbufs_t bufs;
+	cbudget_t budget;
+} lbufs_t;
 
-	lua_pushliteral(L, "");
-	return 1;
+// the budget every cbuf.bufs of this state reports to, kept in the registry
+// so states on other threads never share it
+static cbudget_t* L_root_budget(lua_State* L) {
+	cbudget_t* root;
+
+	lua_getfield(L, LUA_REGISTRYINDEX, L_ROOT_BUDGET);
+	root = (cbudget_t*)lua_touserdata(L, -1);
+	lua_pop(L, 1);
+	return root;
+}
+
+static cbufs_t* L_bufs_push(lua_State* L) {
+	cbudget_t* root = L_root_budget(L);
+	lbufs_t* self = (lbufs_t*)lua_newuserdata(L, sizeof(lbufs_t));
+	cbufs_init(&self->bufs);
+	cbudget_init(&self->budget, 0, 0, root);
+	cbufs_set_budget(&self->bufs, &self->budget);
+	luaL_setmetatable(L, L_BUFS_META);
+	return &self->bufs;
 }
 
 typedef union {
@@ -262,18 +378,153 @@ typedef union {
 	double   f64;
 } num_t;
 
-static int L_buf_pack(lua_State* L) {
-	cbuf_t* self = (cbuf_t*)luaL_checkudata(L, 1, L_BUF_META);
-	int off = luaL_checkint(L, 2);
-	int* sd = (int*)luaL_checkudata(L, 3, L_STRUCT_META) + 1;
-	unsigned char* p = (unsigned char*)cbuf_base(self) + off;
-	int n = 4;
+#define L_ARRAY_CHUNK 256
+
+// elements come from a table or from a cbuf.buf holding them in native order
+static unsigned char* L_array_pack(lua_State* L, int idx, int op, ssize_t count, unsigned char* p) {
+	int width = L_struct_width(op);
+	int swap = (op != L_struct_base(op));
+	cbuf_t* buf = (cbuf_t*)luaL_testudata(L, idx, L_BUF_META);
+	uint64_t tmp[L_ARRAY_CHUNK];
+	ssize_t i, j, m;
+
+	if (buf) {
+		if (cbuf_length(buf) < count * width)
+			luaL_argerror(L, idx, "buffer too short for array");
+		if (swap)
+			cbuf_bswap(p, cbuf_base(buf), count, width);
+		else
+			memcpy(p, cbuf_base(buf), count * width);
+		return p + count * width;
+	}
+
+	luaL_checktype(L, idx, LUA_TTABLE);
+	for (i = 0; i < count; i += m) {
+		m = (count - i < L_ARRAY_CHUNK) ? count - i : L_ARRAY_CHUNK;
+		switch (L_struct_base(op)) {
+#define GET(type, get) \
+	for (j = 0; j < m; ++j) { \
+		int isnum; \
+		lua_rawgeti(L, idx, i + j + 1); \
+		((type*)tmp)[j] = (type)get(L, -1, &isnum); \
+		if (!isnum) \
+			luaL_argerror(L, idx, "array of numbers expected"); \
+		lua_pop(L, 1); \
+	} \
+	break
+		case CSTRUCT_OP_INT8: GET(int8_t, lua_tointegerx);
+		case CSTRUCT_OP_UINT8: GET(uint8_t, lua_tointegerx);
+		case CSTRUCT_OP_INT16: GET(int16_t, lua_tointegerx);
+		case CSTRUCT_OP_UINT16: GET(uint16_t, lua_tointegerx);
+		case CSTRUCT_OP_INT32: GET(int32_t, lua_tointegerx);
+		case CSTRUCT_OP_UINT32: GET(uint32_t, lua_tointegerx);
+		case CSTRUCT_OP_INT64: GET(int64_t, lua_tointegerx);
+		case CSTRUCT_OP_UINT64: GET(uint64_t, lua_tointegerx);
+		case CSTRUCT_OP_FLOAT32: GET(float, lua_tonumberx);
+		case CSTRUCT_OP_FLOAT64: GET(double, lua_tonumberx);
+#undef GET
+		default:
+			assert(0);
+		}
+		if (swap)
+			cbuf_bswap(p, tmp, m, width);
+		else
+			memcpy(p, tmp, m * width);
+		p += m * width;
+	}
+
+	return p;
+}
+
+// pushes a table with count elements decoded from p
+static const unsigned char* L_array_unpack(lua_State* L, int op, ssize_t count, const unsigned char* p) {
+	int width = L_struct_width(op);
+	int swap = (op != L_struct_base(op));
+	uint64_t tmp[L_ARRAY_CHUNK];
+	ssize_t i, j, m;
+
+	lua_createtable(L, (int)count, 0);
+	for (i = 0; i < count; i += m) {
+		m = (count - i < L_ARRAY_CHUNK) ? count - i : L_ARRAY_CHUNK;
+		if (swap)
+			cbuf_bswap(tmp, p, m, width);
+		else
+			memcpy(tmp, p, m * width);
+		p += m * width;
+		switch (L_struct_base(op)) {
+#define SET(type, push) \
+	for (j = 0; j < m; ++j) { \
+		push(L, ((type*)tmp)[j]); \
+		lua_rawseti(L, -2, (int)(i + j + 1)); \
+	} \
+	break
+		case CSTRUCT_OP_INT8: SET(int8_t, lua_pushinteger);
+		case CSTRUCT_OP_UINT8: SET(uint8_t, lua_pushinteger);
+		case CSTRUCT_OP_INT16: SET(int16_t, lua_pushinteger);
+		case CSTRUCT_OP_UINT16: SET(uint16_t, lua_pushinteger);
+		case CSTRUCT_OP_INT32: SET(int32_t, lua_pushinteger);
+		case CSTRUCT_OP_UINT32: SET(uint32_t, lua_pushinteger);
+		case CSTRUCT_OP_INT64: SET(int64_t, lua_pushinteger);
+		case CSTRUCT_OP_UINT64: SET(uint64_t, lua_pushinteger);
+		case CSTRUCT_OP_FLOAT32: SET(float, lua_pushnumber);
+		case CSTRUCT_OP_FLOAT64: SET(double, lua_pushnumber);
+#undef SET
+		default:
+			assert(0);
+		}
+	}
+
+	return p;
+}
+
+// bytes the fields of sd take with the arguments starting at n, each value
+// takes dargs - 1 arguments and each '#' field dargs, its length first
+static ssize_t L_struct_size(lua_State* L, int* sd, int n, int dargs) {
+	ssize_t length = *(sd++);
 	int op;
-	num_t num;
 
-	if (off < 0 || off >= cbuf_length(self))
-		return luaL_argerror(L, 2, "offset out of range");
+	while ((op = *(sd++)) != 0) {
+		switch (op) {
+		case CSTRUCT_OP_PADDING:
+			++sd;
+			break;
+		case CSTRUCT_OP_STRING:
+		case CSTRUCT_OP_ZSTRING:
+			++sd;
+			n += dargs - 1;
+			break;
+		case CSTRUCT_OP_ARRAY:
+			sd += 2;
+			n += dargs - 1;
+			break;
+		case CSTRUCT_OP_DSTRING:
+		case CSTRUCT_OP_DZSTRING:
+		case CSTRUCT_OP_DARRAY:
+			{
+				ssize_t len = luaL_checkinteger(L, n);
+				int width = (op == CSTRUCT_OP_DARRAY) ? L_struct_width(*(sd++)) : 1;
+				if (len < 0)
+					luaL_argerror(L, n, "negative length");
+				if (len > (CX_BUF_LEN_MAX - length) / width)
+					luaL_argerror(L, n, "length out of range");
+				length += len * width;
+				n += dargs;
+			}
+			break;
+		default:
+			n += dargs - 1;
+		}
+	}
+
+	return length;
+}
+
+// p must have room for L_struct_size bytes
+static void L_struct_pack(lua_State* L, int* sd, int n, unsigned char* p) {
+	int op;
+	num_t num;
 
+	++sd;
 	while ((op = *(sd++)) != 0) {
 		switch (op) {
 		case CSTRUCT_OP_PADDING:
@@ -292,17 +543,19 @@ static int L_buf_pack(lua_State* L) {
 				if (length > (size_t)len)
 					length = len;
 				memcpy(p, s, length);
+				memset(p + length, 0, len - length);
 				p += len;
 			}
 			break;
 		case CSTRUCT_OP_DSTRING:
 			{
-				int len = luaL_checkint(L, n++);
+				ssize_t len = luaL_checkinteger(L, n++);
 				size_t length;
 				const char* s = luaL_checklstring(L, n++, &length);
 				if (length > (size_t)len)
 					length = len;
 				memcpy(p, s, length);
+				memset(p + length, 0, len - length);
 				p += len;
 			}
 			break;
@@ -314,19 +567,19 @@ static int L_buf_pack(lua_State* L) {
 				if (length > (size_t)len)
 					length = len;
 				memcpy(p, s, length);
-				p[length] = 0;
+				memset(p + length, 0, len - length + 1);
 				p += (len + 1);
 			}
 			break;
 		case CSTRUCT_OP_DZSTRING:
 			{
-				int len = luaL_checkint(L, n++);
+				ssize_t len = luaL_checkinteger(L, n++);
 				size_t length;
 				const char* s = luaL_checklstring(L, n++, &length);
 				if (length > (size_t)len)
 					length = len;
 				memcpy(p, s, length);
-				p[length] = 0;
+				memset(p + length, 0, len - length + 1);
 				p += (len + 1);
 			}
 			break;
@@ -406,7 +659,7 @@ static int L_buf_pack(lua_State* L) {
 			break;
 		case CSTRUCT_OP_FLOAT64:
 			{
-				num.f64 = (float)luaL_checknumber(L, n++);
+				num.f64 = (double)luaL_checknumber(L, n++);
 				*(p++) = num.b[0];
 				*(p++) = num.b[1];
 				*(p++) = num.b[2];
@@ -486,7 +739,7 @@ static int L_buf_pack(lua_State* L) {
 			break;
 		case CSTRUCT_OP_SW_FLOAT64:
 			{
-				num.f64 = (float)luaL_checknumber(L, n++);
+				num.f64 = (double)luaL_checknumber(L, n++);
 				*(p++) = num.b[7];
 				*(p++) = num.b[6];
 				*(p++) = num.b[5];
@@ -497,36 +750,50 @@ static int L_buf_pack(lua_State* L) {
 				*(p++) = num.b[0];
 			}
 			break;
+		case CSTRUCT_OP_ARRAY:
+			{
+				int eop = *(sd++);
+				ssize_t count = *(sd++);
+				p = L_array_pack(L, n++, eop, count, p);
+			}
+			break;
+		case CSTRUCT_OP_DARRAY:
+			{
+				int eop = *(sd++);
+				ssize_t count = luaL_checkinteger(L, n++);
+				p = L_array_pack(L, n++, eop, count, p);
+			}
+			break;
 		default:
 			assert(0);
 		}
 	}
+}
+
+static int L_buf_pack(lua_State* L) {
+	cbuf_t* self = (cbuf_t*)luaL_checkudata(L, 1, L_BUF_META);
+	ssize_t off = luaL_checkinteger(L, 2);
+	int* sd = L_checkstruct(L, 3);
 
+	if (cbuf_readonly(self))
+		return luaL_argerror(L, 1, "read-only buffer");
+	if (off < 0 || off + L_struct_size(L, sd, 4, 2) > cbuf_length(self))
+		return luaL_argerror(L, 2, "offset out of range");
+	L_struct_pack(L, sd, 4, (unsigned char*)cbuf_base(self) + off);
 	return 0;
 }
 
-static int L_buf_unpack(lua_State* L) {
-	cbuf_t* self = (cbuf_t*)luaL_checkudata(L, 1, L_BUF_META);
-	int off = luaL_checkint(L, 2);
-	int* sd = (int*)luaL_checkudata(L, 3, L_STRUCT_META) + 1;
-	unsigned char* p = (unsigned char*)cbuf_base(self) + off;
-	int n = 4;
+// pushes the fields described by sd read from p, returns how many were pushed
+static int L_struct_unpack(lua_State* L, int* sd, int n, const unsigned char* p) {
 	int r = 0;
 	int op;
 	num_t num;
 
-	if (off < 0 || off >= cbuf_length(self))
-		return luaL_argerror(L, 2, "offset out of range");
-
+	++sd;
 	while ((op = *(sd++)) != 0) {
 		switch (op) {
 		case CSTRUCT_OP_PADDING:
-			{
-				int rep = *(sd++);
-				while (rep-- > 0) {
-					++p;
-				}
-			}
+			p += *(sd++);
 			break;
 		case CSTRUCT_OP_STRING:
 			{
@@ -538,7 +805,7 @@ static int L_buf_unpack(lua_State* L) {
 			break;
 		case CSTRUCT_OP_DSTRING:
 			{
-				int len = luaL_checkint(L, n++);
+				ssize_t len = luaL_checkinteger(L, n++);
 				lua_pushlstring(L, (const char*)p, (size_t)len);
 				++r;
 				p += len;
@@ -554,7 +821,7 @@ static int L_buf_unpack(lua_State* L) {
 			break;
 		case CSTRUCT_OP_DZSTRING:
 			{
-				int len = luaL_checkint(L, n++);
+				ssize_t len = luaL_checkinteger(L, n++);
 				lua_pushlstring(L, (const char*)p, (size_t)len);
 				++r;
 				p += (len + 1);
@@ -562,8 +829,8 @@ static int L_buf_unpack(lua_State* L) {
 			break;
 		case CSTRUCT_OP_INT8:
 			{
-				lua_pushinteger(L, (char)*(p++));
-				++p;
+				lua_pushinteger(L, (signed char)*(p++));
+				++r;
 			}
 			break;
 		case CSTRUCT_OP_UINT8:
@@ -574,129 +841,65 @@ static int L_buf_unpack(lua_State* L) {
 			break;
 		case CSTRUCT_OP_INT16:
 			{
-				if (((uintptr_t)p & 1) == 0) {
-					lua_pushinteger(L, *((int16_t*)p));
-					p += 2;
-				} else {
-					num.b[1] = *(p++);
-					num.b[0] = *(p++);
-					lua_pushinteger(L, num.i16);
-				}
+				memcpy(num.b, p, 2);
+				p += 2;
+				lua_pushinteger(L, num.i16);
 				++r;
 			}
 			break;
 		case CSTRUCT_OP_UINT16:
 			{
-				if (((uintptr_t)p & 1) == 0) {
-					lua_pushinteger(L, *((uint16_t*)p));
-					p += 2;
-				} else {
-					num.b[1] = *(p++);
-					num.b[0] = *(p++);
-					lua_pushinteger(L, num.u16);
-				}
+				memcpy(num.b, p, 2);
+				p += 2;
+				lua_pushinteger(L, num.u16);
 				++r;
 			}
 			break;
 		case CSTRUCT_OP_INT32:
 			{
-				if (((uintptr_t)p & 3) == 0) {
-					lua_pushinteger(L, *((int32_t*)p));
-					p += 4;
-				} else {
-					num.b[3] = *(p++);
-					num.b[2] = *(p++);
-					num.b[1] = *(p++);
-					num.b[0] = *(p++);
-					lua_pushinteger(L, num.i32);
-				}
+				memcpy(num.b, p, 4);
+				p += 4;
+				lua_pushinteger(L, num.i32);
 				++r;
 			}
 			break;
 		case CSTRUCT_OP_UINT32:
 			{
-				if (((uintptr_t)p & 3) == 0) {
-					lua_pushinteger(L, *((uint32_t*)p));
-					p += 4;
-				} else {
-					num.b[3] = *(p++);
-					num.b[2] = *(p++);
-					num.b[1] = *(p++);
-					num.b[0] = *(p++);
-					lua_pushinteger(L, num.i32);
-				}
+				memcpy(num.b, p, 4);
+				p += 4;
+				lua_pushinteger(L, num.u32);
 				++r;
 			}
 			break;
 		case CSTRUCT_OP_INT64:
 			{
-				if (((uintptr_t)p & 7) == 0) {
-					lua_pushinteger(L, *((int64_t*)p));
-					p += 8;
-				} else {
-					num.b[7] = *(p++);
-					num.b[6] = *(p++);
-					num.b[5] = *(p++);
-					num.b[4] = *(p++);
-					num.b[3] = *(p++);
-					num.b[2] = *(p++);
-					num.b[1] = *(p++);
-					num.b[0] = *(p++);
-					lua_pushinteger(L, num.i64);
-				}
+				memcpy(num.b, p, 8);
+				p += 8;
+				lua_pushinteger(L, num.i64);
 				++r;
 			}
 			break;
 		case CSTRUCT_OP_UINT64:
 			{
-				if (((uintptr_t)p & 7) == 0) {
-					lua_pushinteger(L, *((uint64_t*)p));
-					p += 8;
-				} else {
-					num.b[7] = *(p++);
-					num.b[6] = *(p++);
-					num.b[5] = *(p++);
-					num.b[4] = *(p++);
-					num.b[3] = *(p++);
-					num.b[2] = *(p++);
-					num.b[1] = *(p++);
-					num.b[0] = *(p++);
-					lua_pushinteger(L, num.i64);
-				}
+				memcpy(num.b, p, 8);
+				p += 8;
+				lua_pushinteger(L, num.u64);
 				++r;
 			}
 			break;
 		case CSTRUCT_OP_FLOAT32:
 			{
-				if (((uintptr_t)p & 3) == 0) {
-					lua_pushnumber(L, *((float*)p));
-					p += 4;
-				} else {
-					num.b[3] = *(p++);
-					num.b[2] = *(p++);
-					num.b[1] = *(p++);
-					num.b[0] = *(p++);
-					lua_pushnumber(L, num.f32);
-				}
+				memcpy(num.b, p, 4);
+				p += 4;
+				lua_pushnumber(L, num.f32);
 				++r;
 			}
 			break;
 		case CSTRUCT_OP_FLOAT64:
 			{
-				if (((uintptr_t)p & 7) == 0) {
-					lua_pushnumber(L, *((double*)p));
-					p += 4;
-				} else {
-					num.b[7] = *(p++);
-					num.b[6] = *(p++);
-					num.b[5] = *(p++);
-					num.b[4] = *(p++);
-					num.b[3] = *(p++);
-					num.b[2] = *(p++);
-					num.b[1] = *(p++);
-					num.b[0] = *(p++);
-					lua_pushnumber(L, num.f64);
-				}
+				memcpy(num.b, p, 8);
+				p += 8;
+				lua_pushnumber(L, num.f64);
 				++r;
 			}
 			break;
@@ -788,6 +991,22 @@ static int L_buf_unpack(lua_State* L) {
 				++r;
 			}
 			break;
+		case CSTRUCT_OP_ARRAY:
+			{
+				int eop = *(sd++);
+				ssize_t count = *(sd++);
+				p = L_array_unpack(L, eop, count, p);
+				++r;
+			}
+			break;
+		case CSTRUCT_OP_DARRAY:
+			{
+				int eop = *(sd++);
+				ssize_t count = luaL_checkinteger(L, n++);
+				p = L_array_unpack(L, eop, count, p);
+				++r;
+			}
+			break;
 		default:
 			assert(0);
 		}
@@ -796,10 +1015,51 @@ static int L_buf_unpack(lua_State* L) {
 	return r;
 }
 
+static int L_buf_unpack(lua_State* L) {
+	cbuf_t* self = (cbuf_t*)luaL_checkudata(L, 1, L_BUF_META);
+	ssize_t off = luaL_checkinteger(L, 2);
+	int* sd = L_checkstruct(L, 3);
+
+	if (off < 0 || off + L_struct_size(L, sd, 4, 1) > cbuf_length(self))
+		return luaL_argerror(L, 2, "offset out of range");
+	return L_struct_unpack(L, sd, 4, (const unsigned char*)cbuf_base(self) + off);
+}
+
+static int L_tostring(lua_State* L) {
+	cbufs_t* bufs = (cbufs_t*)luaL_testudata(L, 1, L_BUFS_META);
+	cbuf_t* self = bufs ? NULL : (cbuf_t*)luaL_checkudata(L, 1, L_BUF_META);
+	ssize_t len = bufs ? bufs->length : cbuf_length(self);
+	ssize_t start = luaL_optinteger(L, 2, 0);
+	ssize_t n = luaL_optinteger(L, 3, -1);
+	if (start < 0)
+		start += len;
+	if (start >= 0 && start < len) {
+		if (n < 0 || n > len - start)
+			n = len - start;
+		if (n > 0) {
+			if (bufs) {
+				// one copy straight from the segments, the chain is left as is
+				luaL_Buffer b;
+				cbufs_cursor_t cursor;
+				char* p = luaL_buffinitsize(L, &b, (size_t)n);
+				cbufs_cursor_init(&cursor, bufs, start);
+				cbufs_cursor_read(&cursor, n, p);
+				luaL_pushresultsize(&b, (size_t)n);
+			} else {
+				lua_pushlstring(L, cbuf_base(self) + start, n);
+			}
+			return 1;
+		}
+	}
+
+	lua_pushliteral(L, "");
+	return 1;
+}
+
 static int L_bufs_new(lua_State* L) {
-	cbufs_t* self = (cbufs_t*)lua_newuserdata(L, sizeof(cbufs_t));
-	cbufs_init(self);
-	luaL_setmetatable(L, L_BUFS_META);
+	ssize_t coalesce = luaL_optinteger(L, 1, 0);
+	cbufs_t* self = L_bufs_push(L);
+	cbufs_set_coalesce(self, coalesce);
 	return 1;
 }
 
@@ -824,8 +1084,14 @@ static int L_bufs_slice(lua_State* L) {
 
 static int L_bufs_append(lua_State* L) {
 	cbufs_t* self = (cbufs_t*)luaL_checkudata(L, 1, L_BUFS_META);
-	cbuf_t* buf = (cbuf_t*)luaL_checkudata(L, 2, L_BUF_META);
-	cbufs_push(self, buf, 0);
+	if (lua_type(L, 2) == LUA_TSTRING) {
+		size_t l;
+		const char* data = lua_tolstring(L, 2, &l);
+		cbufs_push_data(self, data, (ssize_t)l);
+	} else {
+		cbuf_t* buf = (cbuf_t*)luaL_checkudata(L, 2, L_BUF_META);
+		cbufs_push(self, buf, 0);
+	}
 	lua_settop(L, 1);
 	return 1;
 }
@@ -866,9 +1132,7 @@ static int L_bufs_peek(lua_State* L) {
 static int L_bufs_shift(lua_State* L) {
 	cbufs_t* self = (cbufs_t*)luaL_checkudata(L, 1, L_BUFS_META);
 	ssize_t n = luaL_optinteger(L, 2, -1);
-	cbufs_t* target = (cbufs_t*)lua_newuserdata(L, sizeof(cbufs_t));
-	cbufs_init(target);
-	luaL_setmetatable(L, L_BUFS_META);
+	cbufs_t* target = L_bufs_push(L);
 	cbufs_shift(self, n, target);
 	return 1;
 }
@@ -880,19 +1144,937 @@ static int L_bufs_truncate(lua_State* L) {
 	return 0;
 }
 
-static int L_find(lua_State* L) {
-	int ch;
+// the loop body may change the chain, so every step seeks from the head
+// to the next offset instead of keeping a cursor across calls
+static int L_bufs_each_next(lua_State* L) {
+	cbufs_t* self = (cbufs_t*)lua_touserdata(L, lua_upvalueindex(1));
+	ssize_t off = (ssize_t)lua_tointeger(L, lua_upvalueindex(2));
+	ssize_t limit = (ssize_t)lua_tointeger(L, lua_upvalueindex(3));
+	cbufs_cursor_t cursor;
+	cbuf_t* target;
 	ssize_t n;
-	void* self;
 
-	if (lua_isnumber(L, 2)) {
-		ch = lua_tointeger(L, 2);
-	} else if (lua_isstring(L, 2)) {
-		ch = *lua_tostring(L, 2);
+	if (limit > self->length)
+		limit = self->length;
+	n = limit - off;
+	if (n <= 0)
+		return 0;
+	target = (cbuf_t*)lua_newuserdata(L, sizeof(cbuf_t));
+	target->raw = NULL;
+	target->start = target->end = 0;
+	luaL_setmetatable(L, L_BUF_META);
+	cbufs_cursor_init(&cursor, self, off);
+	if ((n = cbufs_cursor_next_ref(&cursor, n, target)) == 0)
+		return 0;
+	lua_pushinteger(L, off + n);
+	lua_replace(L, lua_upvalueindex(2));
+	lua_pushinteger(L, off);
+	return 2;
+}
+
+static int L_bufs_each(lua_State* L) {
+	cbufs_t* self = (cbufs_t*)luaL_checkudata(L, 1, L_BUFS_META);
+	ssize_t off = luaL_optinteger(L, 2, 0);
+	ssize_t n = luaL_optinteger(L, 3, -1);
+
+	if (off < 0)
+		off += self->length;
+	if (off < 0 || off > self->length)
+		return luaL_argerror(L, 2, "offset out of range");
+	if (n < 0 || n > self->length - off)
+		n = self->length - off;
+
+	lua_settop(L, 1);
+	lua_pushinteger(L, off);
+	lua_pushinteger(L, off + n);
+	lua_pushcclosure(L, L_bufs_each_next, 3);
+	return 1;
+}
+
+// values one record unpacks to, -1 when a field needs a length argument
+static int L_struct_fields(int* sd) {
+	int r = 0;
+	int op;
+
+	++sd;
+	while ((op = *(sd++)) != 0) {
+		switch (op) {
+		case CSTRUCT_OP_PADDING:
+			++sd;
+			break;
+		case CSTRUCT_OP_STRING:
+		case CSTRUCT_OP_ZSTRING:
+			++sd;
+			++r;
+			break;
+		case CSTRUCT_OP_ARRAY:
+			sd += 2;
+			++r;
+			break;
+		case CSTRUCT_OP_DSTRING:
+		case CSTRUCT_OP_DZSTRING:
+		case CSTRUCT_OP_DARRAY:
+			return -1;
+		default:
+			++r;
+		}
+	}
+
+	return r;
+}
+
+// a record split across reads is moved into scratch, so it is never rescanned
+typedef struct {
+	int* sd;
+	ssize_t size;
+	ssize_t fill;
+	int fields;
+	char scratch[1];
+} ldecoder_t;
+
+static int L_decoder_new(lua_State* L) {
+	int* sd = L_checkstruct(L, 1);
+	int fields = L_struct_fields(sd);
+	ldecoder_t* self;
+
+	luaL_checkudata(L, 2, L_BUFS_META);
+	if (fields < 0)
+		return luaL_argerror(L, 1, "fixed-size struct expected");
+	if (sd[0] == 0)
+		return luaL_argerror(L, 1, "empty struct");
+
+	self = (ldecoder_t*)lua_newuserdata(L, offsetof(ldecoder_t, scratch) + sd[0]);
+	self->sd = sd;
+	self->size = sd[0];
+	self->fill = 0;
+	self->fields = fields;
+	luaL_setmetatable(L, L_DECODER_META);
+
+	// keep the descriptor and the source alive as long as the decoder
+	lua_createtable(L, 2, 0);
+	lua_pushvalue(L, 1);
+	lua_rawseti(L, -2, 1);
+	lua_pushvalue(L, 2);
+	lua_rawseti(L, -2, 2);
+	lua_setuservalue(L, -2);
+	return 1;
+}
+
+static int L_decoder_len(lua_State* L) {
+	ldecoder_t* self = (ldecoder_t*)luaL_checkudata(L, 1, L_DECODER_META);
+	lua_pushinteger(L, self->fill);
+	return 1;
+}
+
+static int L_decoder_decode(lua_State* L) {
+	ldecoder_t* self = (ldecoder_t*)luaL_checkudata(L, 1, L_DECODER_META);
+	lua_Integer max = luaL_optinteger(L, 2, -1);
+	lua_Integer count = 0;
+	cbufs_t* bufs;
+
+	lua_getuservalue(L, 1);
+	lua_rawgeti(L, -1, 2);
+	bufs = (cbufs_t*)lua_touserdata(L, -1);
+	lua_pop(L, 2);
+
+	luaL_checkstack(L, self->fields + 4, "too many struct fields");
+	lua_newtable(L);
+	while (max < 0 || count < max) {
+		int i;
+		if (self->fill > 0 || bufs->length < self->size) {
+			ssize_t n = self->size - self->fill;
+			if (n > bufs->length)
+				n = bufs->length;
+			cbufs_shift_to(bufs, n, self->scratch + self->fill);
+			self->fill += n;
+			if (self->fill < self->size)
+				break;
+			self->fill = 0;
+			L_struct_unpack(L, self->sd, 0, (const unsigned char*)self->scratch);
+		} else {
+			cbufs_cursor_t cursor;
+			const char* p;
+			cbufs_cursor_init(&cursor, bufs, 0);
+			p = cbufs_cursor_fetch(&cursor, self->size, self->scratch);
+			L_struct_unpack(L, self->sd, 0, (const unsigned char*)p);
+			cbufs_shift(bufs, self->size, NULL);
+		}
+
+		lua_createtable(L, self->fields, 0);
+		lua_insert(L, -self->fields - 1);
+		for (i = self->fields; i > 0; --i)
+			lua_rawseti(L, -i - 1, i);
+		lua_rawseti(L, -2, (int)++count);
+	}
+
+	lua_pushinteger(L, count);
+	return 2;
+}
+
+// zero-copy view of count elements of one scalar op, indexed from 1
+typedef struct {
+	cbuf_t buf;
+	int op;
+	int width;
+	ssize_t count;
+} larray_t;
+
+static larray_t* L_array_push(lua_State* L, cbuf_t* buf, ssize_t start, int op, ssize_t count) {
+	larray_t* self = (larray_t*)lua_newuserdata(L, sizeof(larray_t));
+	self->width = L_struct_width(op);
+	self->buf = cbuf_mid(buf, start, count * self->width, 0);
+	self->op = op;
+	self->count = count;
+	luaL_setmetatable(L, L_ARRAY_META);
+	return self;
+}
+
+static int L_array_new(lua_State* L) {
+	cbuf_t* buf = (cbuf_t*)luaL_checkudata(L, 1, L_BUF_META);
+	int* sd = L_checkstruct(L, 2);
+	ssize_t off = luaL_optinteger(L, 3, 0);
+	ssize_t length = cbuf_length(buf);
+	ssize_t count;
+	int op = sd[1];
+
+	// the type is a struct format naming exactly one scalar, e.g. ">L"
+	if (op < CSTRUCT_OP_INT8 || op > CSTRUCT_OP_SW_FLOAT64 || sd[2] != 0)
+		return luaL_argerror(L, 2, "single numeric type expected");
+	if (off < 0 || off > length)
+		return luaL_argerror(L, 3, "offset out of range");
+	count = luaL_optinteger(L, 4, (length - off) / L_struct_width(op));
+	if (count < 0 || count > (length - off) / L_struct_width(op))
+		return luaL_argerror(L, 4, "count out of range");
+
+	L_array_push(L, buf, off, op, count);
+	return 1;
+}
+
+static int L_array_gc(lua_State* L) {
+	larray_t* self = (larray_t*)luaL_checkudata(L, 1, L_ARRAY_META);
+	cbuf_fini(&self->buf);
+	return 0;
+}
+
+static int L_array_len(lua_State* L) {
+	larray_t* self = (larray_t*)luaL_checkudata(L, 1, L_ARRAY_META);
+	lua_pushinteger(L, self->count);
+	return 1;
+}
+
+static unsigned char* L_array_at(lua_State* L, larray_t* self, int idx) {
+	ssize_t i = luaL_checkinteger(L, idx);
+	if (i < 1 || i > self->count)
+		luaL_argerror(L, idx, "index out of range");
+	return (unsigned char*)cbuf_base(&self->buf) + (i - 1) * self->width;
+}
+
+static int L_array_index(lua_State* L) {
+	larray_t* self = (larray_t*)luaL_checkudata(L, 1, L_ARRAY_META);
+	const unsigned char* p;
+	num_t num;
+
+	if (lua_type(L, 2) != LUA_TNUMBER)
+		return 0;
+	p = L_array_at(L, self, 2);
+	if (L_struct_base(self->op) != self->op)
+		cbuf_bswap(num.b, p, 1, self->width);
+	else
+		memcpy(num.b, p, self->width);
+
+	switch (L_struct_base(self->op)) {
+	case CSTRUCT_OP_INT8: lua_pushinteger(L, (int8_t)num.b[0]); break;
+	case CSTRUCT_OP_UINT8: lua_pushinteger(L, num.b[0]); break;
+	case CSTRUCT_OP_INT16: lua_pushinteger(L, num.i16); break;
+	case CSTRUCT_OP_UINT16: lua_pushinteger(L, num.u16); break;
+	case CSTRUCT_OP_INT32: lua_pushinteger(L, num.i32); break;
+	case CSTRUCT_OP_UINT32: lua_pushinteger(L, num.u32); break;
+	case CSTRUCT_OP_INT64: lua_pushinteger(L, num.i64); break;
+	case CSTRUCT_OP_UINT64: lua_pushinteger(L, num.u64); break;
+	case CSTRUCT_OP_FLOAT32: lua_pushnumber(L, num.f32); break;
+	default: lua_pushnumber(L, num.f64); break;
+	}
+
+	return 1;
+}
+
+static int L_array_newindex(lua_State* L) {
+	larray_t* self = (larray_t*)luaL_checkudata(L, 1, L_ARRAY_META);
+	unsigned char* p = L_array_at(L, self, 2);
+	num_t num;
+
+	if (cbuf_readonly(&self->buf))
+		return luaL_error(L, "array over a read-only buffer");
+
+	switch (L_struct_base(self->op)) {
+	case CSTRUCT_OP_INT8:
+	case CSTRUCT_OP_UINT8: num.b[0] = (unsigned char)luaL_checkinteger(L, 3); break;
+	case CSTRUCT_OP_INT16: num.i16 = (int16_t)luaL_checkinteger(L, 3); break;
+	case CSTRUCT_OP_UINT16: num.u16 = (uint16_t)luaL_checkinteger(L, 3); break;
+	case CSTRUCT_OP_INT32: num.i32 = (int32_t)luaL_checkinteger(L, 3); break;
+	case CSTRUCT_OP_UINT32: num.u32 = (uint32_t)luaL_checkinteger(L, 3); break;
+	case CSTRUCT_OP_INT64: num.i64 = (int64_t)luaL_checkinteger(L, 3); break;
+	case CSTRUCT_OP_UINT64: num.u64 = (uint64_t)luaL_checkinteger(L, 3); break;
+	case CSTRUCT_OP_FLOAT32: num.f32 = (float)luaL_checknumber(L, 3); break;
+	default: num.f64 = (double)luaL_checknumber(L, 3); break;
+	}
+
+	if (L_struct_base(self->op) != self->op)
+		cbuf_bswap(p, num.b, 1, self->width);
+	else
+		memcpy(p, num.b, self->width);
+	return 0;
+}
+
+// arr(i [, j]) views elements i..j, inclusive like string.sub
+static int L_array_slice(lua_State* L) {
+	larray_t* self = (larray_t*)luaL_checkudata(L, 1, L_ARRAY_META);
+	ssize_t i = luaL_optinteger(L, 2, 1);
+	ssize_t j = luaL_optinteger(L, 3, self->count);
+	if (i < 0)
+		i += self->count + 1;
+	if (j < 0)
+		j += self->count + 1;
+	if (i < 1)
+		i = 1;
+	if (i > self->count + 1)
+		i = self->count + 1;
+	if (j > self->count)
+		j = self->count;
+	if (j < i)
+		j = i - 1;
+	L_array_push(L, &self->buf, (i - 1) * self->width, self->op, j - i + 1);
+	return 1;
+}
+
+static int L_array_reduce(lua_State* L, int what) {
+	larray_t* self = (larray_t*)luaL_checkudata(L, 1, L_ARRAY_META);
+	int base = L_struct_base(self->op);
+	int type = base - CSTRUCT_OP_INT8 + CBUF_INT8;
+	cbuf_reduce_t r;
+
+	cbuf_reduce(cbuf_base(&self->buf), self->count, type, base != self->op, &r);
+	if (what != 0 && r.count == 0)
+		return 0;
+
+	if (type == CBUF_FLOAT32 || type == CBUF_FLOAT64) {
+		// nothing but NaNs
+		if (what != 0 && r.min.f > r.max.f)
+			return 0;
+		lua_pushnumber(L, what == 0 ? r.sum.f : (what < 0 ? r.min.f : r.max.f));
+	} else if (what == 0) {
+		lua_pushinteger(L, (lua_Integer)(type == CBUF_UINT64 ? (int64_t)r.sum.u : r.sum.i));
+	} else if (type == CBUF_INT8 || type == CBUF_INT16 || type == CBUF_INT32 || type == CBUF_INT64) {
+		lua_pushinteger(L, (lua_Integer)(what < 0 ? r.min.i : r.max.i));
+	} else {
+		lua_pushinteger(L, (lua_Integer)(what < 0 ? r.min.u : r.max.u));
+	}
+
+	return 1;
+}
+
+static int L_array_sum(lua_State* L) {
+	return L_array_reduce(L, 0);
+}
+
+static int L_array_min(lua_State* L) {
+	return L_array_reduce(L, -1);
+}
+
+static int L_array_max(lua_State* L) {
+	return L_array_reduce(L, 1);
+}
+
+static int L_builder_new(lua_State* L) {
+	ssize_t hint = luaL_optinteger(L, 1, 0);
+	cbuilder_t* self = (cbuilder_t*)lua_newuserdata(L, sizeof(cbuilder_t));
+	cbuilder_init(self, hint);
+	luaL_setmetatable(L, L_BUILDER_META);
+	return 1;
+}
+
+static int L_builder_gc(lua_State* L) {
+	cbuilder_t* self = (cbuilder_t*)luaL_checkudata(L, 1, L_BUILDER_META);
+	cbuilder_fini(self);
+	return 0;
+}
+
+static int L_builder_len(lua_State* L) {
+	cbuilder_t* self = (cbuilder_t*)luaL_checkudata(L, 1, L_BUILDER_META);
+	lua_pushinteger(L, cbuilder_length(self));
+	return 1;
+}
+
+static int L_builder_put(lua_State* L) {
+	cbuilder_t* self = (cbuilder_t*)luaL_checkudata(L, 1, L_BUILDER_META);
+	int* sd = L_checkstruct(L, 2);
+	ssize_t length = L_struct_size(L, sd, 3, 2);
+	L_struct_pack(L, sd, 3, (unsigned char*)cbuilder_reserve(self, length));
+	cbuilder_commit(self, length);
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int L_builder_write(lua_State* L) {
+	cbuilder_t* self = (cbuilder_t*)luaL_checkudata(L, 1, L_BUILDER_META);
+	void* other;
+
+	if (lua_type(L, 2) == LUA_TSTRING) {
+		size_t l;
+		const char* data = lua_tolstring(L, 2, &l);
+		cbuilder_write(self, data, (ssize_t)l);
+	} else if ((other = luaL_testudata(L, 2, L_BUF_META)) != NULL) {
+		cbuilder_append(self, (cbuf_t*)other, 0);
+	} else if ((other = luaL_testudata(L, 2, L_BUFS_META)) != NULL) {
+		cbufs_cursor_t cursor;
+		cbuf_t t;
+		cbufs_cursor_init(&cursor, (cbufs_t*)other, 0);
+		while (cbufs_cursor_next_ref(&cursor, -1, &t) > 0)
+			cbuilder_append(self, &t, 1);
+	} else {
+		return luaL_argerror(L, 2, "string, cbuf.buf or cbuf.bufs value expected.");
+	}
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int L_builder_varint(lua_State* L) {
+	cbuilder_t* self = (cbuilder_t*)luaL_checkudata(L, 1, L_BUILDER_META);
+	cbuilder_varint(self, (uint64_t)luaL_checkinteger(L, 2));
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int L_builder_finish(lua_State* L) {
+	cbuilder_t* self = (cbuilder_t*)luaL_checkudata(L, 1, L_BUILDER_META);
+	const char* as = luaL_optstring(L, 2, "bufs");
+
+	if (strcmp(as, "buf") == 0) {
+		cbuf_t* target = (cbuf_t*)lua_newuserdata(L, sizeof(cbuf_t));
+		target->raw = NULL;
+		target->start = target->end = 0;
+		luaL_setmetatable(L, L_BUF_META);
+		cbuilder_finish_buf(self, target);
+	} else if (strcmp(as, "bufs") == 0) {
+		cbuilder_finish(self, L_bufs_push(L));
+	} else {
+		return luaL_argerror(L, 2, "'buf' or 'bufs' expected.");
+	}
+
+	return 1;
+}
+
+// a string, cbuf.buf or cbuf.bufs at idx followed by an optional start and
+// length, a chain is returned in *bufs and anything else in *data
+static void L_checkrange(lua_State* L, int idx, cbufs_t** bufs, const char** data, ssize_t* start, ssize_t* n) {
+	cbuf_t* buf;
+	ssize_t len;
+
+	*bufs = (cbufs_t*)luaL_testudata(L, idx, L_BUFS_META);
+	*data = NULL;
+	*start = luaL_optinteger(L, idx + 1, 0);
+	*n = luaL_optinteger(L, idx + 2, -1);
+
+	if (*bufs) {
+		len = (*bufs)->length;
+	} else if ((buf = (cbuf_t*)luaL_testudata(L, idx, L_BUF_META)) != NULL) {
+		*data = cbuf_base(buf);
+		len = cbuf_length(buf);
+	} else {
+		size_t l;
+		*data = luaL_checklstring(L, idx, &l);
+		len = (ssize_t)l;
+	}
+	if (*start < 0)
+		*start += len;
+	if (*start < 0 || *start > len)
+		luaL_argerror(L, idx + 1, "offset out of range");
+	if (*n < 0 || *n > len - *start)
+		*n = len - *start;
+}
+
+// the output is a fresh cbuf.bufs, or nil and a message for malformed input
+static int L_transcode(lua_State* L, int kind) {
+	cbufs_t* bufs;
+	const char* data;
+	ssize_t start, n;
+	cbuilder_t builder;
+	int r;
+
+	L_checkrange(L, 1, &bufs, &data, &start, &n);
+	cbuilder_init(&builder, 0);
+	if (bufs) {
+		r = (cbufs_transcode(bufs, start, n, kind, &builder) < 0) ? -1 : 0;
+	} else {
+		ccodec_t codec;
+		ccodec_init(&codec, kind);
+		r = ccodec_update(&codec, data + start, n, &builder);
+		if (r == 0)
+			r = ccodec_finish(&codec, &builder);
+	}
+
+	if (r != 0) {
+		cbuilder_fini(&builder);
+		lua_pushnil(L);
+		lua_pushstring(L, (kind == CCODEC_BASE64_DECODE) ? "malformed base64 input" : "malformed hex input");
+		return 2;
+	}
+
+	cbuilder_finish(&builder, L_bufs_push(L));
+	cbuilder_fini(&builder);
+	return 1;
+}
+
+static int L_tobase64(lua_State* L) {
+	return L_transcode(L, CCODEC_BASE64_ENCODE);
+}
+
+static int L_frombase64(lua_State* L) {
+	return L_transcode(L, CCODEC_BASE64_DECODE);
+}
+
+static int L_tohex(lua_State* L) {
+	return L_transcode(L, CCODEC_HEX_ENCODE);
+}
+
+static int L_fromhex(lua_State* L) {
+	return L_transcode(L, CCODEC_HEX_DECODE);
+}
+
+static int L_utf8check(lua_State* L) {
+	cbufs_t* bufs;
+	const char* data;
+	ssize_t start, n, r;
+
+	L_checkrange(L, 1, &bufs, &data, &start, &n);
+	if (bufs) {
+		r = cbufs_utf8_check(bufs, start, n);
+	} else {
+		cutf8_t v;
+		cutf8_init(&v);
+		v.offset = start;
+		if ((r = cutf8_update(&v, data + start, n)) < 0)
+			r = cutf8_finish(&v);
+	}
+
+	lua_pushinteger(L, r);
+	return 1;
+}
+
+static int L_utf8stream(lua_State* L) {
+	cutf8_t* self = (cutf8_t*)lua_newuserdata(L, sizeof(cutf8_t));
+	cutf8_init(self);
+	luaL_setmetatable(L, L_UTF8_META);
+	return 1;
+}
+
+// feeds the next piece of a stream, or checks for a truncated tail when
+// called without one, offsets count from the start of the stream
+static int L_utf8feed(lua_State* L) {
+	cutf8_t* self = (cutf8_t*)luaL_checkudata(L, 1, L_UTF8_META);
+	cbufs_t* bufs;
+	const char* data;
+	ssize_t start, n, r = -1;
+
+	if (lua_isnoneornil(L, 2)) {
+		r = cutf8_finish(self);
+	} else {
+		L_checkrange(L, 2, &bufs, &data, &start, &n);
+		if (bufs) {
+			cbufs_cursor_t cursor;
+			cx_buf_t span;
+			cbufs_cursor_init(&cursor, bufs, start);
+			while (n > 0 && cbufs_cursor_next(&cursor, n, &span) > 0) {
+				if ((r = cutf8_update(self, span.base, span.len)) >= 0)
+					break;
+				n -= span.len;
+			}
+		} else {
+			r = cutf8_update(self, data + start, n);
+		}
+	}
+
+	lua_pushinteger(L, r);
+	return 1;
+}
+
+static int L_crc32c(lua_State* L) {
+	cbufs_t* bufs;
+	const char* data;
+	ssize_t start, n;
+	uint32_t crc;
+
+	L_checkrange(L, 1, &bufs, &data, &start, &n);
+	crc = (uint32_t)luaL_optinteger(L, 4, 0);
+	if (bufs)
+		crc = cbufs_crc32c(bufs, start, n, crc);
+	else
+		crc = ccrc32c_update(crc, data + start, n);
+
+	lua_pushinteger(L, crc);
+	return 1;
+}
+
+static int L_crc32c_combine(lua_State* L) {
+	uint32_t crc1 = (uint32_t)luaL_checkinteger(L, 1);
+	uint32_t crc2 = (uint32_t)luaL_checkinteger(L, 2);
+	ssize_t length2 = luaL_checkinteger(L, 3);
+
+	lua_pushinteger(L, ccrc32c_combine(crc1, crc2, length2));
+	return 1;
+}
+
+// sizes the worker pool used by crc32c on large chains, returns the
+// current thread count and minimum range size
+static int L_hashpool(lua_State* L) {
+	ssize_t min_size;
+	int threads;
+
+	if (!lua_isnoneornil(L, 1)) {
+		if (chash_configure((int)luaL_checkinteger(L, 1), luaL_optinteger(L, 2, 0)) != 0)
+			return luaL_error(L, "hash worker pool not supported on this platform");
+	}
+	threads = chash_get_threads(&min_size);
+	lua_pushinteger(L, threads);
+	lua_pushinteger(L, min_size);
+	return 2;
+}
+
+static int L_xxh64(lua_State* L) {
+	cbufs_t* bufs;
+	const char* data;
+	ssize_t start, n;
+	uint64_t seed, h;
+
+	L_checkrange(L, 1, &bufs, &data, &start, &n);
+	seed = (uint64_t)luaL_optinteger(L, 4, 0);
+	if (bufs) {
+		h = cbufs_xxh64(bufs, start, n, seed);
+	} else {
+		cxxh64_t x;
+		cxxh64_update(cxxh64_init(&x, seed), data + start, n);
+		h = cxxh64_digest(&x);
+	}
+
+	lua_pushinteger(L, (lua_Integer)h);
+	return 1;
+}
+
+static int L_xxh64stream(lua_State* L) {
+	uint64_t seed = (uint64_t)luaL_optinteger(L, 1, 0);
+	cxxh64_t* self = (cxxh64_t*)lua_newuserdata(L, sizeof(cxxh64_t));
+	cxxh64_init(self, seed);
+	luaL_setmetatable(L, L_XXH64_META);
+	return 1;
+}
+
+// feeds the next piece of a stream, returns the digest of everything fed
+// so far when called without one
+static int L_xxh64feed(lua_State* L) {
+	cxxh64_t* self = (cxxh64_t*)luaL_checkudata(L, 1, L_XXH64_META);
+	cbufs_t* bufs;
+	const char* data;
+	ssize_t start, n;
+
+	if (lua_isnoneornil(L, 2)) {
+		lua_pushinteger(L, (lua_Integer)cxxh64_digest(self));
+		return 1;
+	}
+
+	L_checkrange(L, 2, &bufs, &data, &start, &n);
+	if (bufs) {
+		cbufs_cursor_t cursor;
+		cx_buf_t span;
+		cbufs_cursor_init(&cursor, bufs, start);
+		while (n > 0 && cbufs_cursor_next(&cursor, n, &span) > 0) {
+			cxxh64_update(self, span.base, span.len);
+			n -= span.len;
+		}
 	} else {
-		return luaL_argerror(L, 2, "integer or string expected.");
+		cxxh64_update(self, data + start, n);
 	}
 
+	lua_settop(L, 1);
+	return 1;
+}
+
+// the output is a fresh cbuf.bufs, or nil and a message for malformed input
+static int L_lz(lua_State* L, int kind) {
+	cbufs_t* bufs;
+	const char* data;
+	ssize_t start, n;
+	cbuilder_t builder;
+	int r;
+
+	L_checkrange(L, 1, &bufs, &data, &start, &n);
+	cbuilder_init(&builder, 0);
+	if (bufs) {
+		r = (cbufs_lz(bufs, start, n, kind, &builder) < 0) ? -1 : 0;
+	} else {
+		clz_t lz;
+		clz_init(&lz, kind);
+		r = clz_update(&lz, data + start, n, &builder);
+		if (r == 0)
+			r = clz_finish(&lz, &builder);
+		clz_fini(&lz);
+	}
+
+	if (r != 0) {
+		cbuilder_fini(&builder);
+		lua_pushnil(L);
+		lua_pushstring(L, "malformed compressed input");
+		return 2;
+	}
+
+	cbuilder_finish(&builder, L_bufs_push(L));
+	cbuilder_fini(&builder);
+	return 1;
+}
+
+static int L_compress(lua_State* L) {
+	return L_lz(L, CLZ_COMPRESS);
+}
+
+static int L_decompress(lua_State* L) {
+	return L_lz(L, CLZ_DECOMPRESS);
+}
+
+static int L_lzstream(lua_State* L) {
+	static const char* const modes[] = { "compress", "decompress", NULL };
+	int kind = luaL_checkoption(L, 1, "compress", modes) + CLZ_COMPRESS;
+	clz_t* self = (clz_t*)lua_newuserdata(L, sizeof(clz_t));
+	clz_init(self, kind);
+	luaL_setmetatable(L, L_LZ_META);
+	return 1;
+}
+
+static int L_lz_gc(lua_State* L) {
+	clz_t* self = (clz_t*)luaL_checkudata(L, 1, L_LZ_META);
+	clz_fini(self);
+	return 0;
+}
+
+// feeds the next piece of a stream and returns the output it completed,
+// called without one it flushes the end of the stream
+static int L_lzfeed(lua_State* L) {
+	clz_t* self = (clz_t*)luaL_checkudata(L, 1, L_LZ_META);
+	cbuilder_t builder;
+	int r = 0;
+
+	cbuilder_init(&builder, 0);
+	if (lua_isnoneornil(L, 2)) {
+		r = clz_finish(self, &builder);
+	} else {
+		cbufs_t* bufs;
+		const char* data;
+		ssize_t start, n;
+		L_checkrange(L, 2, &bufs, &data, &start, &n);
+		if (bufs) {
+			cbufs_cursor_t cursor;
+			cx_buf_t span;
+			cbufs_cursor_init(&cursor, bufs, start);
+			while (r == 0 && n > 0 && cbufs_cursor_next(&cursor, n, &span) > 0) {
+				r = clz_update(self, span.base, span.len, &builder);
+				n -= span.len;
+			}
+		} else {
+			r = clz_update(self, data + start, n, &builder);
+		}
+	}
+
+	if (r != 0) {
+		cbuilder_fini(&builder);
+		lua_pushnil(L);
+		lua_pushstring(L, "malformed compressed input");
+		return 2;
+	}
+
+	cbuilder_finish(&builder, L_bufs_push(L));
+	cbuilder_fini(&builder);
+	return 1;
+}
+
+static int L_cache(lua_State* L) {
+	ssize_t limit = luaL_optinteger(L, 1, CX_BUF_LEN_MAX);
+	ccache_t* self = (ccache_t*)lua_newuserdata(L, sizeof(ccache_t));
+	ccache_init(self, limit);
+	luaL_setmetatable(L, L_CACHE_META);
+	return 1;
+}
+
+static int L_cache_gc(lua_State* L) {
+	ccache_t* self = (ccache_t*)luaL_checkudata(L, 1, L_CACHE_META);
+	ccache_fini(self);
+	return 0;
+}
+
+static int L_cache_len(lua_State* L) {
+	ccache_t* self = (ccache_t*)luaL_checkudata(L, 1, L_CACHE_META);
+	lua_pushinteger(L, self->count);
+	return 1;
+}
+
+// returns the cached cbuf.buf for the payload and whether it was a hit
+static int L_intern(lua_State* L) {
+	ccache_t* self = (ccache_t*)luaL_checkudata(L, 1, L_CACHE_META);
+	cbufs_t* bufs;
+	const char* data;
+	ssize_t start, n;
+	cbuf_t* target;
+	int hit;
+
+	L_checkrange(L, 2, &bufs, &data, &start, &n);
+	target = (cbuf_t*)lua_newuserdata(L, sizeof(cbuf_t));
+	if (bufs)
+		hit = ccache_put_bufs(self, bufs, start, n, target);
+	else
+		hit = ccache_put_data(self, data + start, n, target);
+	luaL_setmetatable(L, L_BUF_META);
+	lua_pushboolean(L, hit);
+	return 2;
+}
+
+static int L_cachetrim(lua_State* L) {
+	ccache_t* self = (ccache_t*)luaL_checkudata(L, 1, L_CACHE_META);
+	if (!lua_isnoneornil(L, 2))
+		self->limit = luaL_checkinteger(L, 2);
+	lua_pushinteger(L, ccache_trim(self, self->limit));
+	return 1;
+}
+
+static int L_cachestats(lua_State* L) {
+	ccache_t* self = (ccache_t*)luaL_checkudata(L, 1, L_CACHE_META);
+	lua_createtable(L, 0, 6);
+#define SET_STAT(name) lua_pushinteger(L, self->name); lua_setfield(L, -2, #name)
+	SET_STAT(limit);
+	SET_STAT(size);
+	SET_STAT(count);
+	SET_STAT(hits);
+	SET_STAT(misses);
+	SET_STAT(evictions);
+#undef SET_STAT
+	return 1;
+}
+
+// cbuf.save(path, bufs...) returns true, or nil and a message
+static int L_save(lua_State* L) {
+	const char* path = luaL_checkstring(L, 1);
+	int i, n = lua_gettop(L) - 1;
+	cbufs_t** chains = (cbufs_t**)lua_newuserdata(L, (n > 0 ? n : 1) * sizeof(cbufs_t*));
+
+	for (i = 0; i < n; ++i)
+		chains[i] = (cbufs_t*)luaL_checkudata(L, i + 2, L_BUFS_META);
+	return luaL_fileresult(L, csnap_save(path, chains, n) == 0, path);
+}
+
+// cbuf.load(path) returns one cbuf.bufs per saved chain, backed by the
+// mapped file, or nil and a message
+static int L_load(lua_State* L) {
+	const char* path = luaL_checkstring(L, 1);
+	csnap_t snap;
+	int i, n = csnap_open(&snap, path);
+	cbufs_t** chains;
+
+	if (n < 0)
+		return luaL_fileresult(L, 0, path);
+	if (!lua_checkstack(L, n + 1)) {
+		csnap_attach(&snap, NULL, 0);
+		return luaL_error(L, "too many chains");
+	}
+	chains = (cbufs_t**)lua_newuserdata(L, (n > 0 ? n : 1) * sizeof(cbufs_t*));
+	for (i = 0; i < n; ++i)
+		chains[i] = L_bufs_push(L);
+	csnap_attach(&snap, chains, n);
+	return n;
+}
+
+static int L_pool(lua_State* L) {
+	static const struct { const char* name; int flag; } options[] = {
+		{ "enable", CPOOL_ENABLE },
+		{ "hugepage", CPOOL_HUGEPAGE },
+		{ "thp", CPOOL_THP },
+		{ "numa", CPOOL_NUMA },
+	};
+	cpool_stats_t stats;
+	size_t i;
+
+	if (lua_istable(L, 1)) {
+		int flags = 0;
+		ssize_t min_size;
+		for (i = 0; i < sizeof(options) / sizeof(options[0]); ++i) {
+			lua_getfield(L, 1, options[i].name);
+			if (lua_toboolean(L, -1))
+				flags |= options[i].flag;
+			lua_pop(L, 1);
+		}
+		lua_getfield(L, 1, "min");
+		min_size = (ssize_t)lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		if (cpool_configure(flags, min_size) != 0)
+			return luaL_error(L, "buffer pool not supported on this platform");
+	}
+
+	cpool_get_stats(&stats);
+	lua_createtable(L, 0, 14);
+	for (i = 0; i < sizeof(options) / sizeof(options[0]); ++i) {
+		lua_pushboolean(L, (stats.flags & options[i].flag) != 0);
+		lua_setfield(L, -2, options[i].name);
+	}
+#define SET_STAT(name) lua_pushinteger(L, stats.name); lua_setfield(L, -2, #name)
+	SET_STAT(min_size);
+	SET_STAT(allocs);
+	SET_STAT(local);
+	SET_STAT(remote);
+	SET_STAT(borrowed);
+	SET_STAT(used);
+	SET_STAT(mapped);
+	SET_STAT(regions);
+	SET_STAT(huge_regions);
+	SET_STAT(remote_regions);
+#undef SET_STAT
+	return 1;
+}
+
+static int L_watermark(lua_State* L) {
+	lbufs_t* self = (lbufs_t*)luaL_testudata(L, 1, L_BUFS_META);
+	cbudget_t* budget = self ? &self->budget : L_root_budget(L);
+	int base = self ? 2 : 1;
+	ssize_t high = luaL_checkinteger(L, base);
+	ssize_t low = luaL_optinteger(L, base + 1, high / 2);
+
+	if (low < 0 || (high > 0 && low > high))
+		return luaL_argerror(L, base + 1, "low watermark out of range");
+	budget->high = high;
+	budget->low = low;
+	// re-evaluate against the new thresholds
+	budget->above = (high > 0 && budget->used >= high);
+	lua_pushboolean(L, budget->above);
+	return 1;
+}
+
+static int L_paused(lua_State* L) {
+	lbufs_t* self = (lbufs_t*)luaL_testudata(L, 1, L_BUFS_META);
+	int above = L_root_budget(L)->above;
+	if (self)
+		above = above || self->budget.above;
+	lua_pushboolean(L, above);
+	return 1;
+}
+
+static int L_checkchar(lua_State* L, int idx) {
+	if (lua_isnumber(L, idx))
+		return (int)lua_tointeger(L, idx);
+	if (lua_isstring(L, idx))
+		return *lua_tostring(L, idx);
+	return luaL_argerror(L, idx, "integer or string expected.");
+}
+
+static int L_find(lua_State* L) {
+	int ch = L_checkchar(L, 2);
+	ssize_t n;
+	void* self;
+
 	if ((self = luaL_testudata(L, 1, L_BUFS_META)) != NULL) {
 		n = cbufs_find((cbufs_t*)self, ch);
 	} else if ((self = luaL_testudata(L, 1, L_BUF_META)) != NULL) {
@@ -905,9 +2087,38 @@ static int L_find(lua_State* L) {
 	return 1;
 }
 
+#define L_SPLIT_BATCH 64
+
+// complete records become cbuf.buf pieces without the delimiter, the
+// trailing partial record stays in the chain
+static int L_split(lua_State* L) {
+	cbufs_t* self = (cbufs_t*)luaL_checkudata(L, 1, L_BUFS_META);
+	int ch = L_checkchar(L, 2);
+	ssize_t max = luaL_optinteger(L, 3, -1);
+	cbuf_t pieces[L_SPLIT_BATCH];
+	ssize_t count = 0;
+	ssize_t k, i;
+
+	lua_newtable(L);
+	do {
+		ssize_t want = (max < 0 || max - count > L_SPLIT_BATCH) ? L_SPLIT_BATCH : max - count;
+		k = cbufs_split_buf(self, ch, want, pieces);
+		for (i = 0; i < k; ++i) {
+			cbuf_t* t = (cbuf_t*)lua_newuserdata(L, sizeof(cbuf_t));
+			*t = pieces[i];
+			luaL_setmetatable(L, L_BUF_META);
+			lua_rawseti(L, -2, (int)(++count));
+		}
+	} while (k == L_SPLIT_BATCH);
+
+	lua_pushinteger(L, count);
+	return 2;
+}
+
 EXPORT int luaopen_cbuf(lua_State* L) {
 	static luaL_Reg struct_meta[] = {
 		{ "__len", L_struct_len },
+		{ NULL, NULL }
 	};
 
 	static luaL_Reg buf_meta[] = {
@@ -924,14 +2135,52 @@ EXPORT int luaopen_cbuf(lua_State* L) {
 		{ NULL, NULL }
 	};
 
+	static luaL_Reg builder_meta[] = {
+		{ "__gc", L_builder_gc },
+		{ "__len", L_builder_len },
+		{ NULL, NULL }
+	};
+
+	static luaL_Reg lz_meta[] = {
+		{ "__gc", L_lz_gc },
+		{ NULL, NULL }
+	};
+
+	static luaL_Reg cache_meta[] = {
+		{ "__gc", L_cache_gc },
+		{ "__len", L_cache_len },
+		{ NULL, NULL }
+	};
+
+	static luaL_Reg decoder_meta[] = {
+		{ "__len", L_decoder_len },
+		{ NULL, NULL }
+	};
+
+	static luaL_Reg array_meta[] = {
+		{ "__gc", L_array_gc },
+		{ "__len", L_array_len },
+		{ "__index", L_array_index },
+		{ "__newindex", L_array_newindex },
+		{ "__call", L_array_slice },
+		{ NULL, NULL }
+	};
+
 	static const luaL_Reg functions[] = {
 		{ "struct", L_struct_new },
 
 		{ "buf", L_buf_new },
 		{ "base", L_buf_base },
-		{ "tostring", L_buf_tostring },
+		{ "tostring", L_tostring },
 		{ "pack", L_buf_pack },
 		{ "unpack", L_buf_unpack },
+		{ "decoder", L_decoder_new },
+		{ "decode", L_decoder_decode },
+
+		{ "array", L_array_new },
+		{ "sum", L_array_sum },
+		{ "min", L_array_min },
+		{ "max", L_array_max },
 
 		{ "bufs", L_bufs_new },
 		{ "append", L_bufs_append },
@@ -941,18 +2190,79 @@ EXPORT int luaopen_cbuf(lua_State* L) {
 		{ "skip", L_bufs_skip },
 		{ "shift", L_bufs_shift },
 		{ "truncate", L_bufs_truncate },
+		{ "each", L_bufs_each },
+
+		{ "builder", L_builder_new },
+		{ "put", L_builder_put },
+		{ "write", L_builder_write },
+		{ "varint", L_builder_varint },
+		{ "finish", L_builder_finish },
+
+		{ "tobase64", L_tobase64 },
+		{ "frombase64", L_frombase64 },
+		{ "tohex", L_tohex },
+		{ "fromhex", L_fromhex },
+
+		{ "utf8check", L_utf8check },
+		{ "utf8stream", L_utf8stream },
+		{ "utf8feed", L_utf8feed },
+		{ "crc32c", L_crc32c },
+		{ "crc32c_combine", L_crc32c_combine },
+		{ "hashpool", L_hashpool },
+		{ "xxh64", L_xxh64 },
+		{ "xxh64stream", L_xxh64stream },
+		{ "xxh64feed", L_xxh64feed },
+		{ "compress", L_compress },
+		{ "decompress", L_decompress },
+		{ "lzstream", L_lzstream },
+		{ "lzfeed", L_lzfeed },
+		{ "cache", L_cache },
+		{ "intern", L_intern },
+		{ "cachetrim", L_cachetrim },
+		{ "cachestats", L_cachestats },
+		{ "save", L_save },
+		{ "load", L_load },
 
 		{ "find", L_find },
+		{ "split", L_split },
+		{ "pool", L_pool },
+		{ "watermark", L_watermark },
+		{ "paused", L_paused },
 
 		{ NULL, NULL }
 	};
 
 	luaL_newmetatable(L, L_STRUCT_META);
 	luaL_setfuncs(L, struct_meta, 0);
+	lua_newtable(L);
+	lua_createtable(L, 0, 1);
+	lua_pushliteral(L, "v");
+	lua_setfield(L, -2, "__mode");
+	lua_setmetatable(L, -2);
+	lua_setfield(L, LUA_REGISTRYINDEX, L_STRUCT_CACHE);
+	// a reload keeps the root existing chains already point at
+	lua_getfield(L, LUA_REGISTRYINDEX, L_ROOT_BUDGET);
+	if (lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+		cbudget_init((cbudget_t*)lua_newuserdata(L, sizeof(cbudget_t)), 0, 0, NULL);
+	}
+	lua_setfield(L, LUA_REGISTRYINDEX, L_ROOT_BUDGET);
 	luaL_newmetatable(L, L_BUF_META);
 	luaL_setfuncs(L, buf_meta, 0);
 	luaL_newmetatable(L, L_BUFS_META);
 	luaL_setfuncs(L, bufs_meta, 0);
+	luaL_newmetatable(L, L_BUILDER_META);
+	luaL_setfuncs(L, builder_meta, 0);
+	luaL_newmetatable(L, L_DECODER_META);
+	luaL_setfuncs(L, decoder_meta, 0);
+	luaL_newmetatable(L, L_ARRAY_META);
+	luaL_setfuncs(L, array_meta, 0);
+	luaL_newmetatable(L, L_UTF8_META);
+	luaL_newmetatable(L, L_XXH64_META);
+	luaL_newmetatable(L, L_LZ_META);
+	luaL_setfuncs(L, lz_meta, 0);
+	luaL_newmetatable(L, L_CACHE_META);
+	luaL_setfuncs(L, cache_meta, 0);
 	luaL_newlib(L, functions);
 	return 1;
 }
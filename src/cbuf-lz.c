@@ -0,0 +1,370 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "crbuf.h"
+
+// input is cut into independent blocks, so both sides keep at most one
+// block of history
+#define CLZ_BLOCK 65536
+#define CLZ_HASH_BITS 12
+#define CLZ_MINMATCH 4
+// the last match starts at least this far from the end of a block
+#define CLZ_MFLIMIT 12
+// and the last bytes of a block are always literals
+#define CLZ_LASTLITERALS 5
+// header word, low bits are the payload length, 0 marks the end
+#define CLZ_STORED 0x80000000u
+
+#define CLZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+static inline uint32_t clz_read32(const unsigned char* p) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static inline uint64_t clz_read64(const unsigned char* p) {
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static inline void clz_put32le(unsigned char* p, uint32_t v) {
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+	p[2] = (unsigned char)(v >> 16);
+	p[3] = (unsigned char)(v >> 24);
+}
+
+static inline uint32_t clz_hash(uint32_t v) {
+	return (v * 2654435761u) >> (32 - CLZ_HASH_BITS);
+}
+
+// length of the common prefix of a and b, b being the earlier position
+static inline ssize_t clz_count(const unsigned char* a, const unsigned char* b, const unsigned char* limit) {
+	const unsigned char* start = a;
+
+	while (limit - a >= 8) {
+		uint64_t d = clz_read64(a) ^ clz_read64(b);
+		if (d != 0) {
+#ifdef CX_IS_BIG_ENDIAN
+			return (a - start) + (__builtin_clzll(d) >> 3);
+#else
+			return (a - start) + (__builtin_ctzll(d) >> 3);
+#endif
+		}
+		a += 8;
+		b += 8;
+	}
+	while (a < limit && *a == *b) {
+		++a;
+		++b;
+	}
+	return a - start;
+}
+
+static inline unsigned char* clz_put_length(unsigned char* op, ssize_t n) {
+	for (; n >= 255; n -= 255)
+		*op++ = 255;
+	*op++ = (unsigned char)n;
+	return op;
+}
+
+static unsigned char* clz_put_sequence(unsigned char* op, const unsigned char* lit, ssize_t nlit, ssize_t offset, ssize_t mlen) {
+	unsigned char* token = op++;
+
+	*token = (unsigned char)((nlit < 15 ? nlit : 15) << 4);
+	if (nlit >= 15)
+		op = clz_put_length(op, nlit - 15);
+	memcpy(op, lit, nlit);
+	op += nlit;
+	if (mlen > 0) {
+		mlen -= CLZ_MINMATCH;
+		*op++ = (unsigned char)offset;
+		*op++ = (unsigned char)(offset >> 8);
+		*token |= (unsigned char)(mlen < 15 ? mlen : 15);
+		if (mlen >= 15)
+			op = clz_put_length(op, mlen - 15);
+	}
+	return op;
+}
+
+// greedy single-probe matcher in the LZ4 block format, out must hold
+// CLZ_BOUND(n) bytes
+static ssize_t clz_compress_block(uint16_t* table, const unsigned char* in, ssize_t n, unsigned char* out) {
+	const unsigned char* ip = in;
+	const unsigned char* anchor = in;
+	const unsigned char* mflimit = in + n - CLZ_MFLIMIT;
+	const unsigned char* mlimit = in + n - CLZ_LASTLITERALS;
+	unsigned char* op = out;
+
+	if (n > CLZ_MFLIMIT) {
+		memset(table, 0, sizeof(uint16_t) << CLZ_HASH_BITS);
+		table[clz_hash(clz_read32(ip))] = 0;
+		++ip;
+		while (ip <= mflimit) {
+			uint32_t h = clz_hash(clz_read32(ip));
+			const unsigned char* ref = in + table[h];
+			ssize_t mlen;
+
+			table[h] = (uint16_t)(ip - in);
+			if (ref >= ip || clz_read32(ref) != clz_read32(ip)) {
+				// step faster through data that keeps missing
+				ip += 1 + ((ip - anchor) >> 6);
+				continue;
+			}
+			while (ip > anchor && ref > in && ip[-1] == ref[-1]) {
+				--ip;
+				--ref;
+			}
+			mlen = CLZ_MINMATCH + clz_count(ip + CLZ_MINMATCH, ref + CLZ_MINMATCH, mlimit);
+			op = clz_put_sequence(op, anchor, ip - anchor, ip - ref, mlen);
+			ip += mlen;
+			anchor = ip;
+			if (ip <= mflimit)
+				table[clz_hash(clz_read32(ip - 2))] = (uint16_t)(ip - 2 - in);
+		}
+	}
+
+	op = clz_put_sequence(op, anchor, in + n - anchor, 0, 0);
+	return op - out;
+}
+
+// returns the decoded length, or -1 when the block is malformed or does
+// not fit in capacity
+static ssize_t clz_decompress_block(const unsigned char* in, ssize_t n, unsigned char* out, ssize_t capacity) {
+	const unsigned char* ip = in;
+	const unsigned char* iend = in + n;
+	unsigned char* op = out;
+	unsigned char* oend = out + capacity;
+
+	while (ip < iend) {
+		unsigned token = *ip++;
+		ssize_t nlit = token >> 4;
+		ssize_t mlen, offset;
+		const unsigned char* ref;
+
+		if (nlit == 15) {
+			unsigned c;
+			do {
+				if (ip >= iend)
+					return -1;
+				c = *ip++;
+				nlit += c;
+			} while (c == 255);
+		}
+		if (nlit > iend - ip || nlit > oend - op)
+			return -1;
+		// a fixed 16 byte copy beats a variable memcpy for short runs
+		if (nlit <= 16 && iend - ip >= 16 && oend - op >= 16)
+			memcpy(op, ip, 16);
+		else
+			memcpy(op, ip, nlit);
+		op += nlit;
+		ip += nlit;
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return -1;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > op - out)
+			return -1;
+		mlen = token & 15;
+		if (mlen == 15) {
+			unsigned c;
+			do {
+				if (ip >= iend)
+					return -1;
+				c = *ip++;
+				mlen += c;
+			} while (c == 255);
+		}
+		mlen += CLZ_MINMATCH;
+		if (mlen > oend - op)
+			return -1;
+		ref = op - offset;
+		if (offset >= 8 && oend - op >= mlen + 8) {
+			// whole words may run past the match, never past the output
+			unsigned char* e = op + mlen;
+			do {
+				memcpy(op, ref, 8);
+				op += 8;
+				ref += 8;
+			} while (op < e);
+			op = e;
+		} else if (offset >= mlen) {
+			memcpy(op, ref, mlen);
+			op += mlen;
+		} else {
+			// overlapping copy repeats the last offset bytes
+			while (mlen-- > 0)
+				*op++ = *ref++;
+		}
+	}
+
+	return op - out;
+}
+
+clz_t* clz_init(clz_t* self, int kind) {
+	self->kind = kind;
+	self->state = 0;
+	self->nbuf = 0;
+	self->need = 0;
+	self->nheader = 0;
+	self->buf = (unsigned char*)MALLOC(CLZ_BLOCK + (kind == CLZ_COMPRESS ? (sizeof(uint16_t) << CLZ_HASH_BITS) : 0));
+	return self;
+}
+
+clz_t* clz_fini(clz_t* self) {
+	FREE(self->buf);
+	self->buf = NULL;
+	return self;
+}
+
+static void clz_emit(clz_t* self, const unsigned char* in, ssize_t n, cbuilder_t* target) {
+	unsigned char* out = (unsigned char*)cbuilder_reserve(target, 4 + CLZ_BOUND(n));
+	ssize_t r = clz_compress_block((uint16_t*)(self->buf + CLZ_BLOCK), in, n, out + 4);
+
+	if (r >= n) {
+		clz_put32le(out, CLZ_STORED | (uint32_t)n);
+		memcpy(out + 4, in, n);
+		r = n;
+	} else {
+		clz_put32le(out, (uint32_t)r);
+	}
+	cbuilder_commit(target, 4 + r);
+}
+
+static int clz_compress(clz_t* self, const unsigned char* p, ssize_t length, cbuilder_t* target) {
+	if (self->nbuf > 0) {
+		ssize_t l = CLZ_BLOCK - self->nbuf;
+		if (l > length)
+			l = length;
+		memcpy(self->buf + self->nbuf, p, l);
+		self->nbuf += l;
+		p += l;
+		length -= l;
+		if (self->nbuf < CLZ_BLOCK)
+			return 0;
+		clz_emit(self, self->buf, CLZ_BLOCK, target);
+		self->nbuf = 0;
+	}
+	// whole blocks are compressed in place, only the tail is copied
+	for (; length >= CLZ_BLOCK; length -= CLZ_BLOCK, p += CLZ_BLOCK)
+		clz_emit(self, p, CLZ_BLOCK, target);
+	memcpy(self->buf, p, length);
+	self->nbuf = length;
+	return 0;
+}
+
+static int clz_block(clz_t* self, const unsigned char* p, cbuilder_t* target) {
+	ssize_t n = self->need;
+
+	if (self->header & CLZ_STORED) {
+		cbuilder_write(target, p, n);
+	} else {
+		unsigned char* out = (unsigned char*)cbuilder_reserve(target, CLZ_BLOCK);
+		if ((n = clz_decompress_block(p, n, out, CLZ_BLOCK)) < 0)
+			return -1;
+		cbuilder_commit(target, n);
+	}
+	self->need = 0;
+	self->nheader = 0;
+	return 0;
+}
+
+static int clz_decompress(clz_t* self, const unsigned char* p, ssize_t length, cbuilder_t* target) {
+	while (length > 0) {
+		ssize_t l;
+		if (self->state > 0)
+			return -1;
+		if (self->need == 0) {
+			// the header may itself be split across segments
+			self->hbuf[self->nheader++] = *p++;
+			--length;
+			if (self->nheader < 4)
+				continue;
+			self->header = self->hbuf[0] | (self->hbuf[1] << 8) | (self->hbuf[2] << 16) | ((uint32_t)self->hbuf[3] << 24);
+			self->need = self->header & ~CLZ_STORED;
+			if (self->need == 0) {
+				if (self->header != 0)
+					return -1;
+				self->state = 1;
+				continue;
+			}
+			if (self->need > CLZ_BLOCK)
+				return -1;
+			self->nbuf = 0;
+			continue;
+		}
+		if (self->nbuf == 0 && length >= self->need) {
+			l = self->need;
+			if (clz_block(self, p, target) != 0)
+				return -1;
+		} else {
+			l = self->need - self->nbuf;
+			if (l > length)
+				l = length;
+			memcpy(self->buf + self->nbuf, p, l);
+			self->nbuf += l;
+			if (self->nbuf == self->need && clz_block(self, self->buf, target) != 0)
+				return -1;
+		}
+		p += l;
+		length -= l;
+	}
+	return 0;
+}
+
+int clz_update(clz_t* self, const void* data, ssize_t length, cbuilder_t* target) {
+	int r;
+
+	if (self->state < 0)
+		return -1;
+	if (self->kind == CLZ_COMPRESS)
+		r = clz_compress(self, (const unsigned char*)data, length, target);
+	else
+		r = clz_decompress(self, (const unsigned char*)data, length, target);
+	if (r != 0)
+		self->state = -1;
+	return r;
+}
+
+// the compressor flushes its last block and the end marker, the
+// decompressor fails unless the end marker was seen
+int clz_finish(clz_t* self, cbuilder_t* target) {
+	if (self->state < 0)
+		return -1;
+	if (self->kind == CLZ_DECOMPRESS)
+		return (self->state > 0) ? 0 : -1;
+	if (self->nbuf > 0)
+		clz_emit(self, self->buf, self->nbuf, target);
+	self->nbuf = 0;
+	clz_put32le((unsigned char*)cbuilder_reserve(target, 4), 0);
+	cbuilder_commit(target, 4);
+	return 0;
+}
+
+ssize_t cbufs_lz(cbufs_t* self, ssize_t start, ssize_t n, int kind, cbuilder_t* target) {
+	ssize_t before = cbuilder_length(target);
+	cbufs_cursor_t cursor;
+	cx_buf_t span;
+	clz_t lz;
+	int r = 0;
+
+	clz_init(&lz, kind);
+	cbufs_cursor_init(&cursor, self, start);
+	if (n < 0 || n > cbufs_cursor_remain(&cursor))
+		n = cbufs_cursor_remain(&cursor);
+	while (r == 0 && n > 0 && cbufs_cursor_next(&cursor, n, &span) > 0) {
+		r = clz_update(&lz, span.base, span.len, target);
+		n -= span.len;
+	}
+	if (r == 0)
+		r = clz_finish(&lz, target);
+	clz_fini(&lz);
+
+	return r == 0 ? cbuilder_length(target) - before : -1;
+}
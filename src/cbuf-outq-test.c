@@ -0,0 +1,128 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crbuf.h"
+
+enum {
+	OUTQTEST_ACCEPT,
+	OUTQTEST_EAGAIN,
+	OUTQTEST_EINTR,
+	OUTQTEST_ZERO,
+};
+
+// a writer that takes at most budget bytes per call, or fails as told
+struct outqtest_writer_s {
+	int mode;
+	ssize_t budget;
+	int calls;
+	ssize_t length;
+	char out[4096];
+};
+
+static int failed = 0;
+
+#define OUTQTEST_CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		failed = 1; \
+	} \
+} while (0)
+
+static ssize_t outqtest_write(void* data, cx_buf_t* bufs, int n) {
+	struct outqtest_writer_s* w = (struct outqtest_writer_s*)data;
+	ssize_t total = 0;
+	int i;
+
+	// a queue that keeps retrying a writer making no progress would hang here
+	if (++w->calls > 1000) {
+		errno = EIO;
+		return -1;
+	}
+	switch (w->mode) {
+	case OUTQTEST_EAGAIN:
+		errno = EAGAIN;
+		return -1;
+	case OUTQTEST_EINTR:
+		w->mode = OUTQTEST_ACCEPT;
+		errno = EINTR;
+		return -1;
+	case OUTQTEST_ZERO:
+		return 0;
+	}
+	for (i = 0; i < n && total < w->budget; ++i) {
+		ssize_t l = (ssize_t)bufs[i].len;
+		if (l > w->budget - total)
+			l = w->budget - total;
+		memcpy(w->out + w->length, bufs[i].base, l);
+		w->length += l;
+		total += l;
+	}
+	return total;
+}
+
+// writes held until the delay passes go out in one call, with the time
+// each one waited accounted
+static void outqtest_delay(void) {
+	struct outqtest_writer_s w = { OUTQTEST_ACCEPT, 4096, 0, 0, {0} };
+	coutq_t q;
+	coutq_stats_t stats;
+
+	coutq_init(&q, outqtest_write, &w);
+	coutq_set_limits(&q, 0, 0, 100);
+	OUTQTEST_CHECK(coutq_deadline(&q) == -1);
+	OUTQTEST_CHECK(coutq_push_data(&q, "alpha ", 6, 1000) == 0);
+	OUTQTEST_CHECK(coutq_push_data(&q, "beta ", 5, 1030) == 0);
+	OUTQTEST_CHECK(coutq_push_data(&q, "gamma", 5, 1060) == 0);
+	OUTQTEST_CHECK(coutq_deadline(&q) == 1100);
+	OUTQTEST_CHECK(coutq_tick(&q, 1099) == 0 && w.calls == 0);
+	OUTQTEST_CHECK(coutq_tick(&q, 1100) == 0 && w.calls == 1);
+	OUTQTEST_CHECK(w.length == 16 && memcmp(w.out, "alpha beta gamma", 16) == 0);
+	OUTQTEST_CHECK(coutq_length(&q) == 0 && coutq_deadline(&q) == -1);
+
+	coutq_get_stats(&q, &stats);
+	OUTQTEST_CHECK(stats.writes == 3 && stats.flushes == 1 && stats.syscalls == 1);
+	OUTQTEST_CHECK(stats.saved == 2 && stats.bytes == 16 && stats.blocked == 0);
+	OUTQTEST_CHECK(stats.delay_total == 100 + 70 + 40 && stats.delay_max == 100);
+	coutq_fini(&q);
+}
+
+// a blocked writer keeps the batch, later pushes wait behind it, and the
+// next flush delivers everything in order through short writes
+static void outqtest_blocked(void) {
+	struct outqtest_writer_s w = { OUTQTEST_EAGAIN, 7, 0, 0, {0} };
+	coutq_t q;
+	coutq_stats_t stats;
+	cbuf_t b;
+
+	coutq_init(&q, outqtest_write, &w);
+	coutq_set_limits(&q, 0, 2, -1);
+	OUTQTEST_CHECK(coutq_push_data(&q, "first ", 6, 0) == 0);
+	OUTQTEST_CHECK(coutq_push_data(&q, "second ", 7, 0) == 1);
+	OUTQTEST_CHECK(w.calls == 1 && coutq_length(&q) == 13);
+	cbuf_init(&b, "third", 5);
+	OUTQTEST_CHECK(coutq_push(&q, &b, 1, 0) == 0);
+	OUTQTEST_CHECK(coutq_tick(&q, 0) == 1 && w.calls == 1);
+
+	w.mode = OUTQTEST_ZERO;
+	OUTQTEST_CHECK(coutq_flush(&q, 0) == 1 && w.calls == 2);
+
+	w.mode = OUTQTEST_EINTR;
+	OUTQTEST_CHECK(coutq_flush(&q, 0) == 0);
+	OUTQTEST_CHECK(coutq_tick(&q, 0) == 0);
+	OUTQTEST_CHECK(w.length == 18 && memcmp(w.out, "first second third", 18) == 0);
+	OUTQTEST_CHECK(coutq_length(&q) == 0);
+
+	coutq_get_stats(&q, &stats);
+	OUTQTEST_CHECK(stats.writes == 3 && stats.flushes == 2 && stats.blocked == 2);
+	OUTQTEST_CHECK(stats.bytes == 18);
+	coutq_fini(&q);
+}
+
+int main(void) {
+	outqtest_delay();
+	outqtest_blocked();
+	printf("cbuf-outq: %s\n", failed ? "FAILED" : "ok");
+	return failed;
+}
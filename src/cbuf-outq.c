@@ -0,0 +1,143 @@
+#include <errno.h>
+#include <string.h>
+
+#include "crbuf.h"
+
+#define COUTQ_BYTES 65536
+#define COUTQ_WRITES 64
+// small writes are copied together so a batch needs fewer iovecs
+#define COUTQ_COALESCE 512
+
+coutq_t* coutq_init(coutq_t* self, coutq_write_cb write, void* data) {
+	cbufs_init(&self->pending);
+	cbufs_set_coalesce(&self->pending, COUTQ_COALESCE);
+	ctrunk_init(&self->trunk, COUTQ_WRITES);
+	self->max_bytes = COUTQ_BYTES;
+	self->max_writes = COUTQ_WRITES;
+	self->max_delay = 0;
+	self->npending = 0;
+	self->first = 0;
+	self->time_sum = 0;
+	self->write = write;
+	self->data = data;
+	memset(&self->stats, 0, sizeof(self->stats));
+	return self;
+}
+
+coutq_t* coutq_fini(coutq_t* self) {
+	cbufs_fini(&self->pending);
+	ctrunk_fini(&self->trunk);
+	return self;
+}
+
+// byte and write limits of 0 or less, or a negative delay, keep the current
+// value; a delay of 0 flushes on every tick
+void coutq_set_limits(coutq_t* self, ssize_t max_bytes, ssize_t max_writes, int64_t max_delay) {
+	if (max_bytes > 0)
+		self->max_bytes = max_bytes;
+	if (max_writes > 0)
+		self->max_writes = max_writes;
+	if (max_delay >= 0)
+		self->max_delay = max_delay;
+}
+
+ssize_t coutq_length(coutq_t* self) {
+	return self->pending.length + self->trunk.length;
+}
+
+static inline int coutq_full(coutq_t* self) {
+	return self->pending.length >= self->max_bytes || self->npending >= self->max_writes;
+}
+
+// hands the pending writes to the trunk and writes until it is drained or
+// the writer would block, which a writer taking no bytes counts as; 1 means
+// blocked, the caller flushes again once the target is writable
+int coutq_flush(coutq_t* self, int64_t now) {
+	if (self->npending > 0) {
+		int64_t delay = now - self->first;
+		self->stats.delay_total += self->npending * now - self->time_sum;
+		if (delay > self->stats.delay_max)
+			self->stats.delay_max = delay;
+		self->stats.flushes++;
+		self->npending = 0;
+		self->time_sum = 0;
+		cbufs_shift_to_trunk(&self->pending, -1, &self->trunk);
+	}
+
+	while (self->trunk.nbufs > 0) {
+		cx_buf_t* bufs;
+		ssize_t n = ctrunk_batch(&self->trunk, &bufs);
+		ssize_t w = self->write(self->data, bufs, (int)n);
+		self->stats.syscalls++;
+		if (w < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				self->stats.blocked++;
+				return 1;
+			}
+			return -1;
+		}
+		if (w == 0) {
+			self->stats.blocked++;
+			return 1;
+		}
+		self->stats.bytes += w;
+		ctrunk_consume(&self->trunk, w);
+	}
+
+	return 0;
+}
+
+int coutq_push(coutq_t* self, cbuf_t* buf, int transfer_reference, int64_t now) {
+	if (cbuf_length(buf) == 0) {
+		if (transfer_reference)
+			cbuf_fini(buf);
+		return 0;
+	}
+	if (self->npending == 0)
+		self->first = now;
+	self->npending++;
+	self->time_sum += now;
+	self->stats.writes++;
+	cbufs_push(&self->pending, buf, transfer_reference);
+	// a batch still in flight means the target is not writable yet
+	return (coutq_full(self) && self->trunk.nbufs == 0) ? coutq_flush(self, now) : 0;
+}
+
+int coutq_push_data(coutq_t* self, const void* data, ssize_t length, int64_t now) {
+	if (length <= 0)
+		return 0;
+	if (self->npending == 0)
+		self->first = now;
+	self->npending++;
+	self->time_sum += now;
+	self->stats.writes++;
+	cbufs_push_data(&self->pending, data, length);
+	return (coutq_full(self) && self->trunk.nbufs == 0) ? coutq_flush(self, now) : 0;
+}
+
+// called once at the end of every event loop iteration; without a delay
+// limit everything queued goes out now, otherwise writes are held until
+// the oldest has waited max_delay or a size limit is hit
+int coutq_tick(coutq_t* self, int64_t now) {
+	if (self->trunk.nbufs > 0)
+		return 1;
+	if (self->npending == 0)
+		return 0;
+	if (self->max_delay > 0 && now - self->first < self->max_delay && !coutq_full(self))
+		return 0;
+	return coutq_flush(self, now);
+}
+
+// when held writes are due, for arming a timer; -1 if nothing is held
+int64_t coutq_deadline(coutq_t* self) {
+	if (self->npending == 0 || self->max_delay <= 0)
+		return -1;
+	return self->first + self->max_delay;
+}
+
+void coutq_get_stats(coutq_t* self, coutq_stats_t* stats) {
+	*stats = self->stats;
+	stats->saved = stats->writes - stats->syscalls;
+}
@@ -0,0 +1,256 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crbuf.h"
+
+#if defined(__linux__)
+# include <pthread.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# define CPOOL_SUPPORTED 1
+#endif
+
+#define CPOOL_MIN_SHIFT 16
+#define CPOOL_MAX_SHIFT 22
+#define CPOOL_NCLASSES (CPOOL_MAX_SHIFT - CPOOL_MIN_SHIFT + 1)
+#define CPOOL_MAX_NODES 64
+#define CPOOL_HUGE_SIZE ((size_t)2 << 20)
+
+#ifndef CPOOL_REGION_SIZE
+# define CPOOL_REGION_SIZE ((size_t)16 << 20)
+#endif
+
+#define CRBUF_POOL_CLASS(flags) (((flags) >> 8) & 0xff)
+#define CRBUF_POOL_NODE(flags) (((flags) >> 16) & 0xff)
+#define CRBUF_POOL_PLACED(flags) ((((flags) >> 24) & 0x7f) - 1)
+
+#ifdef CPOOL_SUPPORTED
+
+#define CPOOL_MPOL_BIND 2
+#define CPOOL_MPOL_F_NODE 1
+#define CPOOL_MPOL_F_ADDR 2
+
+struct cpool_block_s {
+	struct cpool_block_s* next;
+	// node the block's region was found on, -1 when not measured
+	int placed;
+};
+
+struct cpool_node_s {
+	pthread_mutex_t lock;
+	struct cpool_block_s* free[CPOOL_NCLASSES];
+};
+
+static struct cpool_node_s cpool_nodes[CPOOL_MAX_NODES];
+static pthread_once_t cpool_once = PTHREAD_ONCE_INIT;
+static volatile int cpool_flags = 0;
+static volatile ssize_t cpool_min_size = 0;
+static cpool_stats_t cpool_stats;
+
+#define CPOOL_STAT_ADD(field, n) __sync_fetch_and_add(&cpool_stats.field, (n))
+
+static void cpool_setup(void) {
+	int i;
+	for (i = 0; i < CPOOL_MAX_NODES; ++i)
+		pthread_mutex_init(&cpool_nodes[i].lock, NULL);
+}
+
+static int cpool_current_node(void) {
+	unsigned cpu = 0, node = 0;
+	if (!(cpool_flags & CPOOL_NUMA))
+		return 0;
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0 || node >= CPOOL_MAX_NODES)
+		return 0;
+	return (int)node;
+}
+
+static int cpool_page_node(void* addr) {
+	int node = -1;
+	if (syscall(SYS_get_mempolicy, &node, NULL, 0, addr, CPOOL_MPOL_F_NODE | CPOOL_MPOL_F_ADDR) != 0)
+		return -1;
+	return node;
+}
+
+static char* cpool_map_region(int node, int* huge) {
+	size_t size = CPOOL_REGION_SIZE;
+	char* p = MAP_FAILED;
+
+	*huge = 0;
+#ifdef MAP_HUGETLB
+	if (cpool_flags & CPOOL_HUGEPAGE) {
+		p = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED)
+			*huge = 1;
+	}
+#endif
+	if (p == MAP_FAILED) {
+		// over-map so the region can be trimmed to a hugepage boundary
+		char* raw = (char*)mmap(NULL, size + CPOOL_HUGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		size_t head, tail;
+		if (raw == MAP_FAILED)
+			return NULL;
+		head = (CPOOL_HUGE_SIZE - ((uintptr_t)raw & (CPOOL_HUGE_SIZE - 1))) & (CPOOL_HUGE_SIZE - 1);
+		tail = CPOOL_HUGE_SIZE - head;
+		if (head)
+			munmap(raw, head);
+		if (tail)
+			munmap(raw + head + size, tail);
+		p = raw + head;
+#ifdef MADV_HUGEPAGE
+		if (cpool_flags & CPOOL_THP)
+			madvise(p, size, MADV_HUGEPAGE);
+#endif
+	}
+
+	if (cpool_flags & CPOOL_NUMA) {
+		unsigned long mask[CPOOL_MAX_NODES / (8 * sizeof(unsigned long)) + 1];
+		memset(mask, 0, sizeof(mask));
+		mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+		syscall(SYS_mbind, p, size, CPOOL_MPOL_BIND, mask, (unsigned long)CPOOL_MAX_NODES + 1, 0);
+	}
+
+	return p;
+}
+
+// caller holds the node lock
+static int cpool_refill(struct cpool_node_s* pn, int node, int cls) {
+	size_t bsize = (size_t)1 << (cls + CPOOL_MIN_SHIFT);
+	int huge;
+	char* p = cpool_map_region(node, &huge);
+	char* e;
+	int placed = -1;
+
+	if (p == NULL)
+		return 0;
+
+	// fault the first page in so where it landed can be read back
+	if (cpool_flags & CPOOL_NUMA) {
+		*(volatile char*)p = 0;
+		placed = cpool_page_node(p);
+	}
+
+	e = p + CPOOL_REGION_SIZE;
+	while (e != p) {
+		struct cpool_block_s* b;
+		e -= bsize;
+		b = (struct cpool_block_s*)((void*)e);
+		b->next = pn->free[cls];
+		b->placed = placed;
+		pn->free[cls] = b;
+	}
+
+	if (huge)
+		CPOOL_STAT_ADD(huge_regions, 1);
+	else
+		CPOOL_STAT_ADD(regions, 1);
+	if (placed >= 0 && placed != node)
+		CPOOL_STAT_ADD(remote_regions, 1);
+	CPOOL_STAT_ADD(mapped, (ssize_t)CPOOL_REGION_SIZE);
+	return 1;
+}
+
+struct crbuf_s* cpool_crbuf_new(ssize_t length) {
+	size_t need = offsetof(struct crbuf_s, data) + (size_t)length;
+	int cls = 0;
+	int node, home, placed;
+	struct cpool_node_s* pn;
+	struct cpool_block_s* b;
+	struct crbuf_s* raw;
+
+	if (!(cpool_flags & CPOOL_ENABLE) || length < cpool_min_size || need > ((size_t)1 << CPOOL_MAX_SHIFT))
+		return NULL;
+	while (((size_t)1 << (cls + CPOOL_MIN_SHIFT)) < need)
+		++cls;
+
+	home = node = cpool_current_node();
+	pn = &cpool_nodes[node];
+	pthread_mutex_lock(&pn->lock);
+	if (pn->free[cls] == NULL && !cpool_refill(pn, node, cls)) {
+		// local node exhausted, borrow from any node that has a block
+		pthread_mutex_unlock(&pn->lock);
+		for (node = 0; node < CPOOL_MAX_NODES; ++node) {
+			pn = &cpool_nodes[node];
+			pthread_mutex_lock(&pn->lock);
+			if (pn->free[cls])
+				break;
+			pthread_mutex_unlock(&pn->lock);
+		}
+		if (node == CPOOL_MAX_NODES)
+			return NULL;
+	}
+
+	b = pn->free[cls];
+	pn->free[cls] = b->next;
+	placed = b->placed;
+	pthread_mutex_unlock(&pn->lock);
+
+	CPOOL_STAT_ADD(allocs, 1);
+	if (node != home)
+		CPOOL_STAT_ADD(borrowed, 1);
+	if (placed == home)
+		CPOOL_STAT_ADD(local, 1);
+	else if (placed >= 0)
+		CPOOL_STAT_ADD(remote, 1);
+	CPOOL_STAT_ADD(used, (ssize_t)1 << (cls + CPOOL_MIN_SHIFT));
+
+	raw = (struct crbuf_s*)((void*)b);
+	raw->rc = 1;
+	raw->flags = CRBUF_POOL | (cls << 8) | (node << 16) | ((placed + 1) << 24);
+	raw->length = ((ssize_t)1 << (cls + CPOOL_MIN_SHIFT)) - offsetof(struct crbuf_s, data);
+	return raw;
+}
+
+void cpool_crbuf_free(struct crbuf_s* raw) {
+	int cls = CRBUF_POOL_CLASS(raw->flags);
+	struct cpool_node_s* pn = &cpool_nodes[CRBUF_POOL_NODE(raw->flags)];
+	struct cpool_block_s* b = (struct cpool_block_s*)((void*)raw);
+	int placed = CRBUF_POOL_PLACED(raw->flags);
+
+	pthread_mutex_lock(&pn->lock);
+	b->next = pn->free[cls];
+	b->placed = placed;
+	pn->free[cls] = b;
+	pthread_mutex_unlock(&pn->lock);
+
+	CPOOL_STAT_ADD(used, -((ssize_t)1 << (cls + CPOOL_MIN_SHIFT)));
+}
+
+int cpool_configure(int flags, ssize_t min_size) {
+	pthread_once(&cpool_once, cpool_setup);
+	if (min_size < ((ssize_t)1 << (CPOOL_MIN_SHIFT - 1)))
+		min_size = (ssize_t)1 << (CPOOL_MIN_SHIFT - 1);
+	cpool_min_size = min_size;
+	cpool_flags = flags;
+	return 0;
+}
+
+void cpool_get_stats(cpool_stats_t* stats) {
+	*stats = cpool_stats;
+	stats->flags = cpool_flags;
+	stats->min_size = cpool_min_size;
+}
+
+#else
+
+struct crbuf_s* cpool_crbuf_new(ssize_t length) {
+	(void)length;
+	return NULL;
+}
+
+void cpool_crbuf_free(struct crbuf_s* raw) {
+	(void)raw;
+	assert(0);
+}
+
+int cpool_configure(int flags, ssize_t min_size) {
+	(void)min_size;
+	return flags ? -1 : 0;
+}
+
+void cpool_get_stats(cpool_stats_t* stats) {
+	memset(stats, 0, sizeof(*stats));
+}
+
+#endif
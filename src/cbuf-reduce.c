@@ -0,0 +1,140 @@
+#include <math.h>
+#include <string.h>
+
+#include "cbuf.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define CBUF_REDUCE_X86
+#endif
+
+#define CBUF_REDUCE_LANES 8
+#define CBUF_REDUCE_CHUNK 512
+
+typedef void (*cbuf_reduce_fn)(const void* data, ssize_t count, cbuf_reduce_t* r);
+
+// the lanes are independent so the compiler can keep each of them in a
+// vector register, r accumulates across calls. Lanes start from the
+// identity of min and max, so a NaN never compares in and is skipped the
+// same way wherever it sits; integer sums add in uint64_t and wrap
+#define CBUF_REDUCE_KERNEL(attr, name, type, acc, sf, mf, lo0, hi0) \
+attr static void name(const void* data, ssize_t count, cbuf_reduce_t* r) { \
+	const type* p = (const type*)data; \
+	acc s[CBUF_REDUCE_LANES]; \
+	type lo[CBUF_REDUCE_LANES]; \
+	type hi[CBUF_REDUCE_LANES]; \
+	ssize_t i = 0; \
+	int k; \
+	for (k = 0; k < CBUF_REDUCE_LANES; ++k) { \
+		s[k] = 0; \
+		lo[k] = lo0; \
+		hi[k] = hi0; \
+	} \
+	for (; i + CBUF_REDUCE_LANES <= count; i += CBUF_REDUCE_LANES) { \
+		for (k = 0; k < CBUF_REDUCE_LANES; ++k) { \
+			type v = p[i + k]; \
+			s[k] += (acc)v; \
+			lo[k] = v < lo[k] ? v : lo[k]; \
+			hi[k] = v > hi[k] ? v : hi[k]; \
+		} \
+	} \
+	for (; i < count; ++i) { \
+		type v = p[i]; \
+		s[0] += (acc)v; \
+		lo[0] = v < lo[0] ? v : lo[0]; \
+		hi[0] = v > hi[0] ? v : hi[0]; \
+	} \
+	for (k = 0; k < CBUF_REDUCE_LANES; ++k) { \
+		r->sum.sf += s[k]; \
+		if (lo[k] < r->min.mf) \
+			r->min.mf = lo[k]; \
+		if (hi[k] > r->max.mf) \
+			r->max.mf = hi[k]; \
+	} \
+	r->count += count; \
+}
+
+#define CBUF_REDUCE_KERNELS(attr, suffix) \
+	CBUF_REDUCE_KERNEL(attr, cbuf_reduce_i8##suffix, int8_t, uint64_t, u, i, INT8_MAX, INT8_MIN) \
+	CBUF_REDUCE_KERNEL(attr, cbuf_reduce_u8##suffix, uint8_t, uint64_t, u, u, UINT8_MAX, 0) \
+	CBUF_REDUCE_KERNEL(attr, cbuf_reduce_i16##suffix, int16_t, uint64_t, u, i, INT16_MAX, INT16_MIN) \
+	CBUF_REDUCE_KERNEL(attr, cbuf_reduce_u16##suffix, uint16_t, uint64_t, u, u, UINT16_MAX, 0) \
+	CBUF_REDUCE_KERNEL(attr, cbuf_reduce_i32##suffix, int32_t, uint64_t, u, i, INT32_MAX, INT32_MIN) \
+	CBUF_REDUCE_KERNEL(attr, cbuf_reduce_u32##suffix, uint32_t, uint64_t, u, u, UINT32_MAX, 0) \
+	CBUF_REDUCE_KERNEL(attr, cbuf_reduce_i64##suffix, int64_t, uint64_t, u, i, INT64_MAX, INT64_MIN) \
+	CBUF_REDUCE_KERNEL(attr, cbuf_reduce_u64##suffix, uint64_t, uint64_t, u, u, UINT64_MAX, 0) \
+	CBUF_REDUCE_KERNEL(attr, cbuf_reduce_f32##suffix, float, double, f, f, INFINITY, -INFINITY) \
+	CBUF_REDUCE_KERNEL(attr, cbuf_reduce_f64##suffix, double, double, f, f, INFINITY, -INFINITY) \
+	static const cbuf_reduce_fn cbuf_reduce_kernels##suffix[] = { \
+		NULL, \
+		cbuf_reduce_i8##suffix, \
+		cbuf_reduce_u8##suffix, \
+		cbuf_reduce_i16##suffix, \
+		cbuf_reduce_u16##suffix, \
+		cbuf_reduce_i32##suffix, \
+		cbuf_reduce_u32##suffix, \
+		cbuf_reduce_i64##suffix, \
+		cbuf_reduce_u64##suffix, \
+		cbuf_reduce_f32##suffix, \
+		cbuf_reduce_f64##suffix, \
+	};
+
+CBUF_REDUCE_KERNELS(, _generic)
+
+#ifdef CBUF_REDUCE_X86
+CBUF_REDUCE_KERNELS(__attribute__((target("avx2"))), _avx2)
+#endif
+
+static const cbuf_reduce_fn* cbuf_reduce_impl = NULL;
+
+static const cbuf_reduce_fn* cbuf_reduce_resolve(void) {
+#ifdef CBUF_REDUCE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return cbuf_reduce_kernels_avx2;
+#endif
+	return cbuf_reduce_kernels_generic;
+}
+
+static int cbuf_num_width(int type) {
+	static const int widths[] = { 0, 1, 1, 2, 2, 4, 4, 8, 8, 4, 8 };
+	return widths[type];
+}
+
+void cbuf_reduce(const void* data, ssize_t count, int type, int swap, cbuf_reduce_t* r) {
+	const char* p = (const char*)data;
+	int width = cbuf_num_width(type);
+	cbuf_reduce_fn fn;
+
+	memset(r, 0, sizeof(*r));
+	if (type == CBUF_FLOAT32 || type == CBUF_FLOAT64) {
+		r->min.f = INFINITY;
+		r->max.f = -INFINITY;
+	} else if (type == CBUF_INT8 || type == CBUF_INT16 || type == CBUF_INT32 || type == CBUF_INT64) {
+		r->min.i = INT64_MAX;
+		r->max.i = INT64_MIN;
+	} else {
+		r->min.u = UINT64_MAX;
+	}
+	if (count <= 0)
+		return;
+	if (cbuf_reduce_impl == NULL)
+		cbuf_reduce_impl = cbuf_reduce_resolve();
+	fn = cbuf_reduce_impl[type];
+
+	if (!swap && ((uintptr_t)p & (width - 1)) == 0) {
+		fn(p, count, r);
+	} else {
+		// misaligned or foreign order, go through an aligned native copy
+		uint64_t tmp[CBUF_REDUCE_CHUNK];
+		while (count > 0) {
+			ssize_t n = (count < (ssize_t)(sizeof(tmp) / width)) ? count : (ssize_t)(sizeof(tmp) / width);
+			if (swap)
+				cbuf_bswap(tmp, p, n, width);
+			else
+				memcpy(tmp, p, n * width);
+			fn(tmp, n, r);
+			p += n * width;
+			count -= n;
+		}
+	}
+}
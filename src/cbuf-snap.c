@@ -0,0 +1,370 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crbuf.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+# include <fcntl.h>
+# include <pthread.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <sys/uio.h>
+# define CSNAP_SUPPORTED 1
+#endif
+
+// layout, all in the writer's byte order:
+//   header, nchains segment counts (u64), nsegs {offset, length} (u64 each),
+//   then every segment as a crbuf_s header followed by its bytes, so the
+//   mapped file already holds valid crbufs. The header records the word and
+//   crbuf_s header sizes so a build with another layout refuses the file.
+#define CSNAP_MAGIC "CBUFSNP2"
+#define CSNAP_ORDER 0x01020304u
+#define CSNAP_ALIGN 16
+#define CSNAP_RAW_HEADER offsetof(struct crbuf_s, data)
+
+#define CSNAP_ALIGNED(n) (((n) + CSNAP_ALIGN - 1) & ~(uint64_t)(CSNAP_ALIGN - 1))
+
+struct csnap_header_s {
+	char magic[8];
+	uint32_t order;
+	uint32_t nchains;
+	uint32_t word_size;
+	uint32_t raw_header;
+	uint64_t nsegs;
+	uint64_t size;
+};
+
+struct csnap_seg_s {
+	uint64_t offset;
+	uint64_t length;
+};
+
+#ifdef CSNAP_SUPPORTED
+
+// live mappings, released once the last crbuf inside one is freed
+struct csnap_map_s {
+	struct csnap_map_s* next;
+	char* base;
+	size_t size;
+	ssize_t refs;
+};
+
+static pthread_mutex_t csnap_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct csnap_map_s* csnap_maps = NULL;
+
+static void csnap_release(struct csnap_map_s* m, ssize_t n) {
+	struct csnap_map_s** pp;
+
+	pthread_mutex_lock(&csnap_lock);
+	m->refs -= n;
+	if (m->refs > 0) {
+		pthread_mutex_unlock(&csnap_lock);
+		return;
+	}
+	for (pp = &csnap_maps; *pp != m; pp = &(*pp)->next)
+		;
+	*pp = m->next;
+	pthread_mutex_unlock(&csnap_lock);
+	munmap(m->base, m->size);
+	FREE(m);
+}
+
+void csnap_crbuf_free(struct crbuf_s* raw) {
+	struct csnap_map_s* m;
+
+	pthread_mutex_lock(&csnap_lock);
+	for (m = csnap_maps; m; m = m->next) {
+		if ((char*)raw >= m->base && (char*)raw < m->base + m->size)
+			break;
+	}
+	pthread_mutex_unlock(&csnap_lock);
+	assert(m != NULL);
+	csnap_release(m, 1);
+}
+
+static int csnap_writev(int fd, struct iovec* iov, int n) {
+	while (n > 0) {
+		ssize_t r = writev(fd, iov, n < CTRUNK_BATCH_MAX ? n : CTRUNK_BATCH_MAX);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		// skip what was written, a partial entry is advanced in place
+		while (n > 0 && (size_t)r >= iov->iov_len) {
+			r -= iov->iov_len;
+			++iov;
+			--n;
+		}
+		if (n > 0) {
+			iov->iov_base = (char*)iov->iov_base + r;
+			iov->iov_len -= r;
+		}
+	}
+	return 0;
+}
+
+// writes to path.tmp and renames it over path, so a crash never leaves a
+// torn snapshot behind
+int csnap_save(const char* path, cbufs_t** chains, int nchains) {
+	static const char pad[CSNAP_ALIGN] = {0};
+	struct csnap_header_s* header;
+	struct csnap_seg_s* segs;
+	uint64_t* counts;
+	struct crbuf_s* raws;
+	struct iovec* iov;
+	cbufs_cursor_t cursor;
+	cx_buf_t span;
+	uint64_t nsegs = 0, offset;
+	size_t meta;
+	char* tmp;
+	int i, k, niov = 0, fd, r = -1;
+
+	for (i = 0; i < nchains; ++i) {
+		cbufs_cursor_init(&cursor, chains[i], 0);
+		while (cbufs_cursor_next(&cursor, -1, &span) > 0)
+			++nsegs;
+	}
+
+	meta = sizeof(*header) + nchains * sizeof(uint64_t) + nsegs * sizeof(struct csnap_seg_s);
+	header = (struct csnap_header_s*)MALLOC(meta);
+	counts = (uint64_t*)(header + 1);
+	segs = (struct csnap_seg_s*)(counts + nchains);
+	raws = (struct crbuf_s*)MALLOC((nsegs ? nsegs : 1) * sizeof(struct crbuf_s));
+	// the metadata and its padding, then header, bytes and padding per segment
+	iov = (struct iovec*)MALLOC((2 + nsegs * 3) * sizeof(struct iovec));
+
+	iov[niov].iov_base = header;
+	iov[niov++].iov_len = meta;
+	offset = CSNAP_ALIGNED(meta);
+	if (offset > meta) {
+		iov[niov].iov_base = (void*)pad;
+		iov[niov++].iov_len = offset - meta;
+	}
+	for (i = 0, k = 0; i < nchains; ++i) {
+		counts[i] = 0;
+		cbufs_cursor_init(&cursor, chains[i], 0);
+		while (cbufs_cursor_next(&cursor, -1, &span) > 0) {
+			uint64_t end = offset + CSNAP_RAW_HEADER + span.len;
+			raws[k].rc = 1;
+			raws[k].flags = CRBUF_MAPPED;
+			raws[k].length = span.len;
+			segs[k].offset = offset;
+			segs[k].length = span.len;
+			iov[niov].iov_base = &raws[k];
+			iov[niov++].iov_len = CSNAP_RAW_HEADER;
+			iov[niov].iov_base = span.base;
+			iov[niov++].iov_len = span.len;
+			offset = CSNAP_ALIGNED(end);
+			if (offset > end) {
+				iov[niov].iov_base = (void*)pad;
+				iov[niov++].iov_len = offset - end;
+			}
+			++counts[i];
+			++k;
+		}
+	}
+	memcpy(header->magic, CSNAP_MAGIC, sizeof(header->magic));
+	header->order = CSNAP_ORDER;
+	header->nchains = (uint32_t)nchains;
+	header->word_size = (uint32_t)sizeof(ssize_t);
+	header->raw_header = (uint32_t)CSNAP_RAW_HEADER;
+	header->nsegs = nsegs;
+	header->size = offset;
+
+	tmp = (char*)MALLOC(strlen(path) + 5);
+	sprintf(tmp, "%s.tmp", path);
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0) {
+		if (csnap_writev(fd, iov, niov) == 0 && fsync(fd) == 0)
+			r = 0;
+		if (close(fd) != 0)
+			r = -1;
+		if (r == 0)
+			r = rename(tmp, path);
+		if (r != 0) {
+			int e = errno;
+			unlink(tmp);
+			errno = e;
+		}
+	}
+
+	FREE(tmp);
+	FREE(iov);
+	FREE(raws);
+	FREE(header);
+	return r;
+}
+
+static int csnap_check(const char* base, size_t size) {
+	const struct csnap_header_s* header = (const struct csnap_header_s*)base;
+	const uint64_t* counts;
+	const struct csnap_seg_s* segs;
+	uint64_t i, total = 0, start;
+
+	if (size < sizeof(*header) || memcmp(header->magic, CSNAP_MAGIC, sizeof(header->magic)) != 0 ||
+		header->order != CSNAP_ORDER || header->word_size != sizeof(ssize_t) ||
+		header->raw_header != CSNAP_RAW_HEADER || header->size != size)
+		return -1;
+	if (header->nsegs > (size - sizeof(*header)) / sizeof(struct csnap_seg_s) ||
+		header->nchains > (size - sizeof(*header)) / sizeof(uint64_t))
+		return -1;
+	start = sizeof(*header) + header->nchains * sizeof(uint64_t) + header->nsegs * sizeof(struct csnap_seg_s);
+	if (start > size)
+		return -1;
+
+	counts = (const uint64_t*)(header + 1);
+	for (i = 0; i < header->nchains; ++i) {
+		if (counts[i] > header->nsegs - total)
+			return -1;
+		total += counts[i];
+	}
+	if (total != header->nsegs)
+		return -1;
+
+	// segments must be in order and disjoint, each header is written to
+	segs = (const struct csnap_seg_s*)(counts + header->nchains);
+	for (i = 0; i < header->nsegs; ++i) {
+		if (segs[i].offset < start || segs[i].offset % CSNAP_ALIGN != 0 ||
+			segs[i].offset > size - CSNAP_RAW_HEADER || segs[i].length == 0 ||
+			segs[i].length > size - segs[i].offset - CSNAP_RAW_HEADER)
+			return -1;
+		start = segs[i].offset + CSNAP_RAW_HEADER + segs[i].length;
+	}
+	return 0;
+}
+
+// maps path and validates it, returns the number of chains in the file;
+// csnap_attach must follow to hand them out or drop the mapping
+int csnap_open(csnap_t* self, const char* path) {
+	struct csnap_map_s* m;
+	struct stat st;
+	char* base;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -1;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return -1;
+	}
+	if ((size_t)st.st_size < sizeof(struct csnap_header_s)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	// writable so the crbuf headers can be touched. MAP_PRIVATE keeps those
+	// writes out of the file but does not shield the mapping from it: pages
+	// not written yet still see later writes, and truncation makes them
+	// fault, so a loaded snapshot must only ever be replaced by rename, as
+	// csnap_save does
+	base = (char*)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return -1;
+	if (csnap_check(base, st.st_size) != 0) {
+		munmap(base, st.st_size);
+		errno = EINVAL;
+		return -1;
+	}
+
+	m = (struct csnap_map_s*)MALLOC(sizeof(struct csnap_map_s));
+	m->next = NULL;
+	m->base = base;
+	m->size = st.st_size;
+	m->refs = 0;
+	self->map = m;
+	self->nchains = (int)((const struct csnap_header_s*)base)->nchains;
+	return self->nchains;
+}
+
+// appends the first nchains chains of an opened snapshot to chains without
+// copying any payload, the rest are dropped along with the handle
+void csnap_attach(csnap_t* self, cbufs_t** chains, int nchains) {
+	struct csnap_map_s* m = self->map;
+	const struct csnap_header_s* header = (const struct csnap_header_s*)m->base;
+	const uint64_t* counts = (const uint64_t*)(header + 1);
+	const struct csnap_seg_s* segs = (const struct csnap_seg_s*)(counts + header->nchains);
+	char* base = m->base;
+	uint64_t i, j, k = 0;
+	ssize_t loaded = 0;
+
+	for (i = 0; i < header->nchains && (int)i < nchains; ++i)
+		loaded += counts[i];
+	// one per segment handed out, plus one held until all of them are
+	m->refs = loaded + 1;
+	pthread_mutex_lock(&csnap_lock);
+	m->next = csnap_maps;
+	csnap_maps = m;
+	pthread_mutex_unlock(&csnap_lock);
+
+	for (i = 0; i < header->nchains && (int)i < nchains; ++i) {
+		for (j = 0; j < counts[i]; ++j, ++k) {
+			struct crbuf_s* raw = (struct crbuf_s*)(base + segs[k].offset);
+			cbuf_t t;
+			raw->rc = 1;
+			raw->flags = CRBUF_MAPPED;
+			raw->length = (ssize_t)segs[k].length;
+			t.raw = raw;
+			t.start = 0;
+			t.end = raw->length;
+			cbufs_push(chains[i], &t, 1);
+		}
+	}
+
+	self->map = NULL;
+	csnap_release(m, 1);
+}
+
+// maps path and appends its chains to the first nchains of chains, returns
+// the number of chains in the file
+int csnap_load(const char* path, cbufs_t** chains, int nchains) {
+	csnap_t snap;
+	int count = csnap_open(&snap, path);
+
+	if (count >= 0)
+		csnap_attach(&snap, chains, nchains);
+	return count;
+}
+
+#else
+
+void csnap_crbuf_free(struct crbuf_s* raw) {
+	(void)raw;
+	assert(0);
+}
+
+int csnap_save(const char* path, cbufs_t** chains, int nchains) {
+	(void)path;
+	(void)chains;
+	(void)nchains;
+	errno = ENOSYS;
+	return -1;
+}
+
+int csnap_load(const char* path, cbufs_t** chains, int nchains) {
+	(void)path;
+	(void)chains;
+	(void)nchains;
+	errno = ENOSYS;
+	return -1;
+}
+
+int csnap_open(csnap_t* self, const char* path) {
+	(void)path;
+	self->map = NULL;
+	self->nchains = 0;
+	errno = ENOSYS;
+	return -1;
+}
+
+void csnap_attach(csnap_t* self, cbufs_t** chains, int nchains) {
+	(void)self;
+	(void)chains;
+	(void)nchains;
+}
+
+#endif
@@ -0,0 +1,112 @@
+#include <string.h>
+
+#include "cbuf.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define CBUF_SWAP_X86
+# include <immintrin.h>
+#endif
+
+typedef void (*cbuf_bswap_fn)(unsigned char* d, const unsigned char* s, ssize_t count, int width);
+
+static void cbuf_bswap_scalar(unsigned char* d, const unsigned char* s, ssize_t count, int width) {
+	ssize_t i;
+	int k;
+
+#ifdef __GNUC__
+	switch (width) {
+	case 2:
+		for (i = 0; i < count; ++i, s += 2, d += 2) {
+			uint16_t v;
+			memcpy(&v, s, 2);
+			v = __builtin_bswap16(v);
+			memcpy(d, &v, 2);
+		}
+		return;
+	case 4:
+		for (i = 0; i < count; ++i, s += 4, d += 4) {
+			uint32_t v;
+			memcpy(&v, s, 4);
+			v = __builtin_bswap32(v);
+			memcpy(d, &v, 4);
+		}
+		return;
+	case 8:
+		for (i = 0; i < count; ++i, s += 8, d += 8) {
+			uint64_t v;
+			memcpy(&v, s, 8);
+			v = __builtin_bswap64(v);
+			memcpy(d, &v, 8);
+		}
+		return;
+	}
+#endif
+
+	for (i = 0; i < count; ++i, s += width, d += width) {
+		unsigned char t[8];
+		for (k = 0; k < width; ++k)
+			t[k] = s[width - 1 - k];
+		memcpy(d, t, width);
+	}
+}
+
+#ifdef CBUF_SWAP_X86
+static const unsigned char cbuf_bswap_masks[3][16] = {
+	{ 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14 },
+	{ 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12 },
+	{ 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8 },
+};
+
+static const unsigned char* cbuf_bswap_mask(int width) {
+	return cbuf_bswap_masks[width == 2 ? 0 : (width == 4 ? 1 : 2)];
+}
+
+__attribute__((target("ssse3")))
+static void cbuf_bswap_ssse3(unsigned char* d, const unsigned char* s, ssize_t count, int width) {
+	__m128i mask = _mm_loadu_si128((const __m128i*)cbuf_bswap_mask(width));
+	ssize_t bytes = count * width;
+	ssize_t i = 0;
+
+	for (; i + 16 <= bytes; i += 16)
+		_mm_storeu_si128((__m128i*)(d + i), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(s + i)), mask));
+	cbuf_bswap_scalar(d + i, s + i, (bytes - i) / width, width);
+}
+
+__attribute__((target("avx2")))
+static void cbuf_bswap_avx2(unsigned char* d, const unsigned char* s, ssize_t count, int width) {
+	__m128i half = _mm_loadu_si128((const __m128i*)cbuf_bswap_mask(width));
+	__m256i mask = _mm256_broadcastsi128_si256(half);
+	ssize_t bytes = count * width;
+	ssize_t i = 0;
+
+	for (; i + 32 <= bytes; i += 32)
+		_mm256_storeu_si256((__m256i*)(d + i), _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(s + i)), mask));
+	for (; i + 16 <= bytes; i += 16)
+		_mm_storeu_si128((__m128i*)(d + i), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(s + i)), half));
+	cbuf_bswap_scalar(d + i, s + i, (bytes - i) / width, width);
+}
+#endif
+
+static cbuf_bswap_fn cbuf_bswap_impl = NULL;
+
+static cbuf_bswap_fn cbuf_bswap_resolve(void) {
+#ifdef CBUF_SWAP_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return cbuf_bswap_avx2;
+	if (__builtin_cpu_supports("ssse3"))
+		return cbuf_bswap_ssse3;
+#endif
+	return cbuf_bswap_scalar;
+}
+
+void cbuf_bswap(void* target, const void* source, ssize_t count, int width) {
+	if (width < 2 || count <= 0) {
+		if (target != source && count > 0)
+			memmove(target, source, count * width);
+		return;
+	}
+	if (cbuf_bswap_impl == NULL)
+		cbuf_bswap_impl = cbuf_bswap_resolve();
+	cbuf_bswap_impl((unsigned char*)target, (const unsigned char*)source, count, width);
+}
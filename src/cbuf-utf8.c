@@ -0,0 +1,245 @@
+#include <string.h>
+
+#include "cbuf.h"
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define CUTF8_X86
+# include <immintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+# include <pthread.h>
+# define CUTF8_ONCE
+#endif
+
+static int cutf8_simd = 0;
+
+static void cutf8_setup(void) {
+#ifdef CUTF8_X86
+	__builtin_cpu_init();
+	cutf8_simd = __builtin_cpu_supports("ssse3") ? 1 : 0;
+#else
+	cutf8_simd = 0;
+#endif
+}
+
+// validators run on any thread, the detection happens exactly once
+#ifdef CUTF8_ONCE
+static pthread_once_t cutf8_once = PTHREAD_ONCE_INIT;
+# define CUTF8_SETUP() pthread_once(&cutf8_once, cutf8_setup)
+#else
+static int cutf8_ready = 0;
+# define CUTF8_SETUP() do { if (!cutf8_ready) { cutf8_setup(); cutf8_ready = 1; } } while (0)
+#endif
+
+cutf8_t* cutf8_init(cutf8_t* self) {
+	CUTF8_SETUP();
+	self->offset = 0;
+	self->start = -1;
+	self->remain = 0;
+	self->lo = 0x80;
+	self->hi = 0xbf;
+	return self;
+}
+
+// length of the leading run of ASCII bytes in p
+static ssize_t cutf8_ascii(const unsigned char* p, ssize_t n) {
+	ssize_t i = 0;
+
+#if defined(__SSE2__)
+	for (; i + 32 <= n; i += 32) {
+		__m128i a = _mm_loadu_si128((const __m128i*)(p + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(p + i + 16));
+		if (_mm_movemask_epi8(_mm_or_si128(a, b)) != 0)
+			break;
+	}
+	for (; i + 16 <= n; i += 16) {
+		if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(p + i))) != 0)
+			break;
+	}
+#endif
+	while (i < n && p[i] < 0x80)
+		++i;
+	return i;
+}
+
+#ifdef CUTF8_X86
+// error classes of a byte pair, looked up by the high and low nibble of the
+// first byte and the high nibble of the second, a pair is valid when the
+// three lookups share no bit
+#define CUTF8_TOO_SHORT  (1 << 0)	// lead not followed by a continuation
+#define CUTF8_TOO_LONG   (1 << 1)	// ASCII followed by a continuation
+#define CUTF8_OVERLONG_3 (1 << 2)	// e0 80..9f
+#define CUTF8_TOO_LARGE  (1 << 3)	// f4 90..bf, f5..ff
+#define CUTF8_SURROGATE  (1 << 4)	// ed a0..bf
+#define CUTF8_OVERLONG_2 (1 << 5)	// c0, c1
+#define CUTF8_OVERLONG_4 (1 << 6)	// f0 80..8f, also f5..ff 80..8f
+#define CUTF8_TWO_CONTS  (1 << 7)	// continuation after continuation
+#define CUTF8_CARRY (CUTF8_TOO_SHORT | CUTF8_TOO_LONG | CUTF8_TWO_CONTS)
+
+// length of the leading run of p that holds only complete, valid characters,
+// checked 16 bytes at a time with pshufb lookups
+__attribute__((target("ssse3")))
+static ssize_t cutf8_valid_ssse3(const unsigned char* p, ssize_t n) {
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	const __m128i byte1_high = _mm_setr_epi8(
+		CUTF8_TOO_LONG, CUTF8_TOO_LONG, CUTF8_TOO_LONG, CUTF8_TOO_LONG,
+		CUTF8_TOO_LONG, CUTF8_TOO_LONG, CUTF8_TOO_LONG, CUTF8_TOO_LONG,
+		(char)CUTF8_TWO_CONTS, (char)CUTF8_TWO_CONTS, (char)CUTF8_TWO_CONTS, (char)CUTF8_TWO_CONTS,
+		CUTF8_TOO_SHORT | CUTF8_OVERLONG_2,
+		CUTF8_TOO_SHORT,
+		CUTF8_TOO_SHORT | CUTF8_OVERLONG_3 | CUTF8_SURROGATE,
+		CUTF8_TOO_SHORT | CUTF8_TOO_LARGE | CUTF8_OVERLONG_4);
+	const __m128i byte1_low = _mm_setr_epi8(
+		(char)(CUTF8_CARRY | CUTF8_OVERLONG_3 | CUTF8_OVERLONG_2 | CUTF8_OVERLONG_4),
+		(char)(CUTF8_CARRY | CUTF8_OVERLONG_2),
+		(char)CUTF8_CARRY,
+		(char)CUTF8_CARRY,
+		(char)(CUTF8_CARRY | CUTF8_TOO_LARGE),
+		(char)(CUTF8_CARRY | CUTF8_TOO_LARGE | CUTF8_OVERLONG_4),
+		(char)(CUTF8_CARRY | CUTF8_TOO_LARGE | CUTF8_OVERLONG_4),
+		(char)(CUTF8_CARRY | CUTF8_TOO_LARGE | CUTF8_OVERLONG_4),
+		(char)(CUTF8_CARRY | CUTF8_TOO_LARGE | CUTF8_OVERLONG_4),
+		(char)(CUTF8_CARRY | CUTF8_TOO_LARGE | CUTF8_OVERLONG_4),
+		(char)(CUTF8_CARRY | CUTF8_TOO_LARGE | CUTF8_OVERLONG_4),
+		(char)(CUTF8_CARRY | CUTF8_TOO_LARGE | CUTF8_OVERLONG_4),
+		(char)(CUTF8_CARRY | CUTF8_TOO_LARGE | CUTF8_OVERLONG_4),
+		(char)(CUTF8_CARRY | CUTF8_TOO_LARGE | CUTF8_OVERLONG_4 | CUTF8_SURROGATE),
+		(char)(CUTF8_CARRY | CUTF8_TOO_LARGE | CUTF8_OVERLONG_4),
+		(char)(CUTF8_CARRY | CUTF8_TOO_LARGE | CUTF8_OVERLONG_4));
+	const __m128i byte2_high = _mm_setr_epi8(
+		CUTF8_TOO_SHORT, CUTF8_TOO_SHORT, CUTF8_TOO_SHORT, CUTF8_TOO_SHORT,
+		CUTF8_TOO_SHORT, CUTF8_TOO_SHORT, CUTF8_TOO_SHORT, CUTF8_TOO_SHORT,
+		(char)(CUTF8_TOO_LONG | CUTF8_OVERLONG_2 | CUTF8_TWO_CONTS | CUTF8_OVERLONG_3 | CUTF8_OVERLONG_4),
+		(char)(CUTF8_TOO_LONG | CUTF8_OVERLONG_2 | CUTF8_TWO_CONTS | CUTF8_OVERLONG_3 | CUTF8_TOO_LARGE),
+		(char)(CUTF8_TOO_LONG | CUTF8_OVERLONG_2 | CUTF8_TWO_CONTS | CUTF8_SURROGATE | CUTF8_TOO_LARGE),
+		(char)(CUTF8_TOO_LONG | CUTF8_OVERLONG_2 | CUTF8_TWO_CONTS | CUTF8_SURROGATE | CUTF8_TOO_LARGE),
+		CUTF8_TOO_SHORT, CUTF8_TOO_SHORT, CUTF8_TOO_SHORT, CUTF8_TOO_SHORT);
+	__m128i prev = _mm_setzero_si128();
+	ssize_t i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m128i in = _mm_loadu_si128((const __m128i*)(p + i));
+		__m128i prev1, special, third, fourth, must;
+		if (_mm_movemask_epi8(_mm_or_si128(in, prev)) == 0) {
+			prev = in;
+			continue;
+		}
+		prev1 = _mm_alignr_epi8(in, prev, 15);
+		special = _mm_and_si128(
+			_mm_and_si128(
+				_mm_shuffle_epi8(byte1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+				_mm_shuffle_epi8(byte1_low, _mm_and_si128(prev1, nibble))),
+			_mm_shuffle_epi8(byte2_high, _mm_and_si128(_mm_srli_epi16(in, 4), nibble)));
+		// the third and fourth bytes of a character only show up as two
+		// continuations in a row, which must be exactly where e0+ and f0+
+		// leads two and three bytes back expect them
+		third = _mm_subs_epu8(_mm_alignr_epi8(in, prev, 14), _mm_set1_epi8(0x60));
+		fourth = _mm_subs_epu8(_mm_alignr_epi8(in, prev, 13), _mm_set1_epi8(0x70));
+		must = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8((char)0x80));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_xor_si128(must, special), _mm_setzero_si128())) != 0xffff)
+			break;
+		prev = in;
+	}
+
+	// a character starting in the last three checked bytes may be cut short
+	// by the failing block or the end of p, leave it to the scalar path
+	if (i >= 16) {
+		if (p[i - 1] >= 0xc0)
+			i -= 1;
+		else if (p[i - 2] >= 0xe0)
+			i -= 2;
+		else if (p[i - 3] >= 0xf0)
+			i -= 3;
+	}
+	return i;
+}
+#endif
+
+// length of the leading run of p that is valid and ends on a character
+// boundary, the scalar path takes over from there
+static ssize_t cutf8_valid(const unsigned char* p, ssize_t n) {
+	ssize_t i = 0;
+
+#ifdef CUTF8_X86
+	if (cutf8_simd > 0)
+		i = cutf8_valid_ssse3(p, n);
+#endif
+	return i + cutf8_ascii(p + i, n - i);
+}
+
+ssize_t cutf8_update(cutf8_t* self, const void* data, ssize_t length) {
+	const unsigned char* p = (const unsigned char*)data;
+	ssize_t i = 0;
+
+	if (self->remain < 0)
+		return self->start;
+
+	while (i < length) {
+		unsigned c;
+		if (self->remain == 0) {
+			i += cutf8_valid(p + i, length - i);
+			if (i == length)
+				break;
+			c = p[i];
+			self->start = self->offset + i;
+			if (c < 0xc2 || c > 0xf4) {
+				self->remain = -1;
+				return self->start;
+			} else if (c < 0xe0) {
+				self->remain = 1;
+			} else if (c < 0xf0) {
+				// no overlongs below 0x800, no surrogates
+				self->remain = 2;
+				self->lo = (c == 0xe0) ? 0xa0 : 0x80;
+				self->hi = (c == 0xed) ? 0x9f : 0xbf;
+			} else {
+				// no overlongs below 0x10000, nothing above 0x10ffff
+				self->remain = 3;
+				self->lo = (c == 0xf0) ? 0x90 : 0x80;
+				self->hi = (c == 0xf4) ? 0x8f : 0xbf;
+			}
+		} else {
+			c = p[i];
+			if (c < self->lo || c > self->hi) {
+				self->remain = -1;
+				return self->start;
+			}
+			--self->remain;
+			self->lo = 0x80;
+			self->hi = 0xbf;
+		}
+		++i;
+	}
+
+	self->offset += length;
+	return -1;
+}
+
+ssize_t cutf8_finish(cutf8_t* self) {
+	return (self->remain != 0) ? self->start : -1;
+}
+
+ssize_t cbufs_utf8_check(cbufs_t* self, ssize_t start, ssize_t n) {
+	cbufs_cursor_t cursor;
+	cutf8_t v;
+	cx_buf_t span;
+	ssize_t r;
+
+	cutf8_init(&v);
+	v.offset = start;
+	cbufs_cursor_init(&cursor, self, start);
+	if (n < 0 || n > cbufs_cursor_remain(&cursor))
+		n = cbufs_cursor_remain(&cursor);
+	while (n > 0 && cbufs_cursor_next(&cursor, n, &span) > 0) {
+		if ((r = cutf8_update(&v, span.base, span.len)) >= 0)
+			return r;
+		n -= span.len;
+	}
+
+	return cutf8_finish(&v);
+}
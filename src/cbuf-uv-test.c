@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crbuf.h"
+#include "cbuf-uv.h"
+
+#define UVTEST_SEGMENTS 150
+#define UVTEST_SEGMENT_SIZE 100
+
+struct uvtest_s {
+	uv_loop_t* loop;
+	uv_tcp_t server;
+	uv_tcp_t peer;
+	uv_tcp_t client;
+	uv_connect_t connect;
+	cbufs_t peer_in;
+	cbufs_t client_in;
+	char expect[UVTEST_SEGMENTS * UVTEST_SEGMENT_SIZE];
+	cbuf_t kept[UVTEST_SEGMENTS];
+	int writes;
+	int failed;
+};
+
+static struct uvtest_s t;
+
+#define UVTEST_CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		t.failed = 1; \
+	} \
+} while (0)
+
+static void uvtest_on_write(cbuf_uv_write_t* req, int status) {
+	(void)req;
+	UVTEST_CHECK(status == 0);
+	++t.writes;
+}
+
+static void uvtest_peer_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
+	cbuf_uv_read_cb(stream, nread, buf);
+	if (t.peer_in.length == (ssize_t)sizeof(t.expect)) {
+		UVTEST_CHECK(cbuf_uv_write_bufs(stream, &t.peer_in, -1, uvtest_on_write, NULL) == 0);
+		UVTEST_CHECK(t.peer_in.length == 0);
+	}
+}
+
+static void uvtest_client_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
+	cbuf_uv_read_cb(stream, nread, buf);
+	if (t.client_in.length == (ssize_t)sizeof(t.expect)) {
+		UVTEST_CHECK(memcmp(cbufs_base(&t.client_in, -1), t.expect, sizeof(t.expect)) == 0);
+		uv_close((uv_handle_t*)&t.client, NULL);
+		uv_close((uv_handle_t*)&t.peer, NULL);
+		uv_close((uv_handle_t*)&t.server, NULL);
+	}
+}
+
+static void uvtest_on_accept(uv_stream_t* server, int status) {
+	UVTEST_CHECK(status == 0);
+	uv_tcp_init(t.loop, &t.peer);
+	t.peer.data = &t.peer_in;
+	UVTEST_CHECK(uv_accept(server, (uv_stream_t*)&t.peer) == 0);
+	uv_read_start((uv_stream_t*)&t.peer, cbuf_uv_alloc_cb, uvtest_peer_read);
+}
+
+// sends every segment as its own iovec, growing the trunk past its
+// initial capacity on the way
+static void uvtest_on_connect(uv_connect_t* req, int status) {
+	cbufs_t out;
+	ctrunk_t trunk;
+	int i;
+
+	UVTEST_CHECK(status == 0);
+	cbufs_init(&out);
+	for (i = 0; i < UVTEST_SEGMENTS; ++i) {
+		cbuf_t b;
+		cbuf_init(&b, t.expect + i * UVTEST_SEGMENT_SIZE, UVTEST_SEGMENT_SIZE);
+		t.kept[i] = cbuf_ref(&b, 0);
+		cbufs_push(&out, &b, 1);
+	}
+
+	ctrunk_init(&trunk, 4);
+	cbufs_shift_to_trunk(&out, -1, &trunk);
+	UVTEST_CHECK(trunk.nbufs == UVTEST_SEGMENTS);
+	UVTEST_CHECK(trunk.length == (ssize_t)sizeof(t.expect));
+	UVTEST_CHECK(cbuf_uv_write(req->handle, &trunk, uvtest_on_write, NULL) == 0);
+	UVTEST_CHECK(trunk.nbufs == 0);
+	cbufs_fini(&out);
+
+	req->handle->data = &t.client_in;
+	uv_read_start(req->handle, cbuf_uv_alloc_cb, uvtest_client_read);
+}
+
+// small reads are copied out and leave their buffer for the next alloc,
+// consecutive ones coalesce into a single entry
+static void uvtest_small_reads(void) {
+	cbufs_t in;
+	uv_buf_t buf, again;
+
+	cbufs_init(&in);
+	cbufs_set_coalesce(&in, 64);
+	cbuf_uv_alloc_cb(NULL, 65536, &buf);
+	memcpy(buf.base, "hello ", 6);
+	UVTEST_CHECK(cbuf_uv_read(&in, 6, &buf) == 6);
+	cbuf_uv_alloc_cb(NULL, 65536, &again);
+	UVTEST_CHECK(again.base == buf.base);
+	memcpy(again.base, "world", 5);
+	UVTEST_CHECK(cbuf_uv_read(&in, 5, &again) == 5);
+	UVTEST_CHECK(in.length == 11 && cx_queue_head(&in.bufs) == cx_queue_tail(&in.bufs));
+	UVTEST_CHECK(memcmp(cbufs_base(&in, -1), "hello world", 11) == 0);
+	cbufs_fini(&in);
+	cbuf_uv_cleanup();
+}
+
+int main(void) {
+	struct sockaddr_in addr;
+	int namelen = sizeof(addr);
+	size_t i;
+
+	for (i = 0; i < sizeof(t.expect); ++i)
+		t.expect[i] = (char)('a' + (i * 7 + i / UVTEST_SEGMENT_SIZE) % 26);
+	t.loop = uv_default_loop();
+	cbufs_init(&t.peer_in);
+	cbufs_init(&t.client_in);
+
+	uv_ip4_addr("127.0.0.1", 0, &addr);
+	uv_tcp_init(t.loop, &t.server);
+	if (uv_tcp_bind(&t.server, (const struct sockaddr*)&addr, 0) != 0 ||
+		uv_listen((uv_stream_t*)&t.server, 1, uvtest_on_accept) != 0) {
+		fprintf(stderr, "cannot listen on loopback\n");
+		return 1;
+	}
+	uv_tcp_getsockname(&t.server, (struct sockaddr*)&addr, &namelen);
+	uv_tcp_init(t.loop, &t.client);
+	uv_tcp_connect(&t.connect, &t.client, (const struct sockaddr*)&addr, uvtest_on_connect);
+	uv_run(t.loop, UV_RUN_DEFAULT);
+
+	// both writes completed and dropped their references, only ours remain
+	UVTEST_CHECK(t.writes == 2);
+	UVTEST_CHECK(t.client_in.length == (ssize_t)sizeof(t.expect));
+	for (i = 0; i < UVTEST_SEGMENTS; ++i) {
+		UVTEST_CHECK(t.kept[i].raw->rc == 1);
+		cbuf_fini(&t.kept[i]);
+	}
+	cbufs_fini(&t.peer_in);
+	cbufs_fini(&t.client_in);
+	uv_loop_close(t.loop);
+	cbuf_uv_cleanup();
+
+	uvtest_small_reads();
+
+	printf("cbuf-uv loopback: %s\n", t.failed ? "FAILED" : "ok");
+	return t.failed;
+}
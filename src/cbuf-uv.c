@@ -0,0 +1,115 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#include "crbuf.h"
+#include "cbuf-uv.h"
+
+// reads up to this size are copied into the chain, where they coalesce,
+// instead of pinning a whole suggested_size buffer each
+#ifndef CBUF_UV_COPY_MAX
+# define CBUF_UV_COPY_MAX 4096
+#endif
+
+// the read buffer handed back by the last small read on this thread, libuv
+// runs each loop on one thread so the next alloc on it can reuse the buffer
+static CX_THREAD_LOCAL struct crbuf_s* cbuf_uv_spare = NULL;
+
+void cbuf_uv_alloc_cb(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
+	struct crbuf_s* raw = cbuf_uv_spare;
+	(void)handle;
+
+	if (raw && raw->length >= (ssize_t)suggested_size) {
+		cbuf_uv_spare = NULL;
+	} else {
+		raw = crbuf_new((ssize_t)suggested_size);
+	}
+	buf->base = raw->data;
+	buf->len = raw->length;
+}
+
+ssize_t cbuf_uv_read(cbufs_t* bufs, ssize_t nread, const uv_buf_t* buf) {
+	struct crbuf_s* raw;
+
+	if (buf->base == NULL)
+		return nread;
+
+	raw = CX_GET_SELF(buf->base, struct crbuf_s, data);
+	if (nread > CBUF_UV_COPY_MAX) {
+		cbuf_t b;
+		b.raw = raw;
+		b.start = 0;
+		b.end = nread;
+		cbufs_push(bufs, &b, 1);
+		return nread;
+	}
+
+	if (nread > 0)
+		cbufs_push_data(bufs, raw->data, nread);
+	if (cbuf_uv_spare == NULL)
+		cbuf_uv_spare = raw;
+	else
+		crbuf_unref(raw);
+	return nread;
+}
+
+// frees the buffer kept for reuse, once a thread is done with its loop
+void cbuf_uv_cleanup(void) {
+	if (cbuf_uv_spare) {
+		crbuf_unref(cbuf_uv_spare);
+		cbuf_uv_spare = NULL;
+	}
+}
+
+void cbuf_uv_read_cb(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
+	if (cbuf_uv_read((cbufs_t*)stream->data, nread, buf) < 0)
+		uv_read_stop(stream);
+}
+
+static void cbuf_uv_after_write(uv_write_t* req, int status) {
+	cbuf_uv_write_t* self = CX_GET_SELF(req, cbuf_uv_write_t, req);
+	if (self->cb)
+		self->cb(self, status);
+	ctrunk_fini(&self->trunk);
+	FREE(self);
+}
+
+int cbuf_uv_write(uv_stream_t* stream, ctrunk_t* trunk, cbuf_uv_write_cb cb, void* data) {
+	cbuf_uv_write_t* self = CX_NEW(MALLOC, cbuf_uv_write_t, 0);
+	int err;
+
+	self->trunk = *trunk;
+	self->cb = cb;
+	self->data = data;
+	ctrunk_init(trunk, 0);
+
+	err = uv_write(&self->req, stream, self->trunk.bufs, (unsigned int)self->trunk.nbufs, cbuf_uv_after_write);
+	if (err != 0) {
+		ctrunk_fini(&self->trunk);
+		FREE(self);
+	}
+
+	return err;
+}
+
+int cbuf_uv_write_bufs(uv_stream_t* stream, cbufs_t* bufs, ssize_t n, cbuf_uv_write_cb cb, void* data) {
+	ctrunk_t trunk;
+	ctrunk_init(&trunk, 0);
+	cbufs_shift_to_trunk(bufs, n, &trunk);
+	return cbuf_uv_write(stream, &trunk, cb, data);
+}
+
+// a coutq_write_cb for a uv_stream_t passed as data, typically flushed from
+// a uv_check_t so each loop iteration ends with one coutq_tick
+ssize_t cbuf_uv_try_write(void* data, cx_buf_t* bufs, int n) {
+	int r = uv_try_write((uv_stream_t*)data, bufs, (unsigned int)n);
+	if (r >= 0)
+		return r;
+	// libuv error codes are negated errno values outside Windows
+#ifdef _WIN32
+	errno = (r == UV_EAGAIN) ? EAGAIN : EIO;
+#else
+	errno = -r;
+#endif
+	return -1;
+}
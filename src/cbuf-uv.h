@@ -0,0 +1,28 @@
+#ifndef __CBUF_UV_H__
+#define __CBUF_UV_H__
+
+#ifndef CX_WITH_UV
+# error "cbuf-uv.h requires the library to be built with CX_WITH_UV"
+#endif
+
+#include "cbuf.h"
+
+typedef struct cbuf_uv_write_s cbuf_uv_write_t;
+typedef void (*cbuf_uv_write_cb)(cbuf_uv_write_t* req, int status);
+
+struct cbuf_uv_write_s {
+	uv_write_t req;
+	ctrunk_t trunk;
+	cbuf_uv_write_cb cb;
+	void* data;
+};
+
+CX_API void      cbuf_uv_alloc_cb(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf);
+CX_API ssize_t   cbuf_uv_read(cbufs_t* bufs, ssize_t nread, const uv_buf_t* buf);
+CX_API void      cbuf_uv_read_cb(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf);
+CX_API void      cbuf_uv_cleanup(void);
+CX_API int       cbuf_uv_write(uv_stream_t* stream, ctrunk_t* trunk, cbuf_uv_write_cb cb, void* data);
+CX_API int       cbuf_uv_write_bufs(uv_stream_t* stream, cbufs_t* bufs, ssize_t n, cbuf_uv_write_cb cb, void* data);
+CX_API ssize_t   cbuf_uv_try_write(void* data, cx_buf_t* bufs, int n);
+
+#endif
@@ -2,31 +2,61 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "cbuf.h"
+#include "crbuf.h"
 
-#ifndef MALLOC
-# define MALLOC(n) malloc(n)
-# define REALLOC(p, n) realloc(p, n)
-# define FREE(p) free(p)
+#ifndef CBUFS_INLINE_MAX
+# define CBUFS_INLINE_MAX 32
 #endif
 
-struct crbuf_s {
-	int     rc;
-	ssize_t length;
-	char    data[1];
+#ifndef CBUFS_COALESCE_CHUNK
+# define CBUFS_COALESCE_CHUNK 1024
+#endif
+
+// fresh tail buffers are 8 times the threshold, which must not overflow
+#ifndef CBUFS_COALESCE_MAX
+# define CBUFS_COALESCE_MAX (1 << 20)
+#endif
+
+struct cbufe_s {
+	cbuf_t buf;
+	cx_queue_t qh;
 };
 
-struct crbuf_s* crbuf_new(ssize_t length) {
+// segment node carrying its own payload, the node holds one reference on raw
+struct cbufe_inline_s {
+	struct cbufe_s e;
+	struct crbuf_s raw;
+};
+
+static struct crbuf_s* crbuf_alloc(ssize_t length) {
 	struct crbuf_s* raw = NULL;
 	raw = (struct crbuf_s*)MALLOC(offsetof(struct crbuf_s, data) + length);
 	raw->rc = 1;
+	raw->flags = 0;
 	raw->length = length;
 	return raw;
 }
 
+struct crbuf_s* crbuf_new(ssize_t length) {
+	struct crbuf_s* raw = carena_crbuf_new(length);
+	if (raw == NULL && (raw = cpool_crbuf_new(length)) == NULL)
+		raw = crbuf_alloc(length);
+	return raw;
+}
+
 void crbuf_unref(struct crbuf_s* self) {
-	if (--self->rc == 0)
-		FREE(self);
+	if (--self->rc == 0) {
+		if (self->flags & CRBUF_INLINE)
+			FREE(CX_GET_SELF(self, struct cbufe_inline_s, raw));
+		else if (self->flags & CRBUF_ARENA)
+			carena_crbuf_free(self);
+		else if (self->flags & CRBUF_POOL)
+			cpool_crbuf_free(self);
+		else if (self->flags & CRBUF_MAPPED)
+			csnap_crbuf_free(self);
+		else
+			FREE(self);
+	}
 }
 
 cbuf_t* cbuf_init(cbuf_t* self, const void* data, ssize_t length) {
@@ -79,6 +109,11 @@ char* cbuf_base(cbuf_t* self) {
 	return self->raw ? self->raw->data + self->start : NULL;
 }
 
+// payloads shared through a ccache must not be written in place
+int cbuf_readonly(cbuf_t* self) {
+	return self->raw && (self->raw->flags & CRBUF_READONLY);
+}
+
 void cbuf_swap(cbuf_t* self, cbuf_t* other) {
 	cbuf_t t = *self;
 	*self = *other;
@@ -236,39 +271,125 @@ ssize_t cbuf_pop(cbuf_t* self, ssize_t n, cbuf_t* target) {
 ssize_t cbuf_find(cbuf_t* self, int ch) {
 	ssize_t length = self->end - self->start;
 	if (length > 0) {
-		char* p = self->raw->data + self->start;
-		char* e = p + length;
-		ssize_t r = 0;
-		while (p != e) {
-			if (*p == ch)
-				return r;
-			++r;
-			++p;
-		}
+		const char* p = self->raw->data + self->start;
+		const char* r = (const char*)memchr(p, ch, length);
+		if (r)
+			return r - p;
 	}
 
 	return -1;
 }
 
-struct cbufe_s {
-	cbuf_t buf;
-	cx_queue_t qh;
-};
+cbuf_t* cbuf_escape(cbuf_t* self) {
+	struct crbuf_s* raw = self->raw;
+	if (raw && (raw->flags & CRBUF_ARENA)) {
+		ssize_t length = self->end - self->start;
+		struct crbuf_s* copy = crbuf_alloc(length);
+		memcpy(copy->data, raw->data + self->start, length);
+		crbuf_unref(raw);
+		self->raw = copy;
+		self->start = 0;
+		self->end = length;
+	}
+
+	return self;
+}
+
+static struct cbufe_s* cbufe_new_inline(const void* data, ssize_t length) {
+	struct cbufe_inline_s* n = CX_NEW2(MALLOC, struct cbufe_inline_s, raw.data, CBUFS_INLINE_MAX);
+	assert(length > 0 && length <= CBUFS_INLINE_MAX);
+	n->raw.rc = 2;
+	n->raw.flags = CRBUF_INLINE;
+	n->raw.length = CBUFS_INLINE_MAX;
+	memcpy(n->raw.data, data, length);
+	n->e.buf.raw = &n->raw;
+	n->e.buf.start = 0;
+	n->e.buf.end = length;
+	return &n->e;
+}
+
+static inline int cbufe_is_inline(struct cbufe_s* e) {
+	struct crbuf_s* raw = e->buf.raw;
+	return raw && (raw->flags & CRBUF_INLINE) && raw == &((struct cbufe_inline_s*)e)->raw;
+}
+
+// release a node whose buffer reference has already been moved out
+static inline void cbufe_free(struct cbufe_s* e) {
+	if (cbufe_is_inline(e))
+		crbuf_unref(e->buf.raw);
+	else
+		FREE(e);
+}
+
+// release a node together with the buffer reference it holds
+static inline void cbufe_drop(struct cbufe_s* e) {
+	if (cbufe_is_inline(e)) {
+		struct crbuf_s* raw = e->buf.raw;
+		--raw->rc;
+		crbuf_unref(raw);
+	} else {
+		cbuf_fini(&e->buf);
+		FREE(e);
+	}
+}
+
+cbudget_t* cbudget_init(cbudget_t* self, ssize_t high, ssize_t low, cbudget_t* parent) {
+	self->used = 0;
+	self->high = high;
+	self->low = low;
+	self->above = 0;
+	self->cb = NULL;
+	self->data = NULL;
+	self->parent = parent;
+	return self;
+}
+
+void cbudget_add(cbudget_t* self, ssize_t delta) {
+	for (; self; self = self->parent) {
+		self->used += delta;
+		if (!self->above) {
+			if (self->high > 0 && self->used >= self->high) {
+				self->above = 1;
+				if (self->cb)
+					self->cb(self, 1);
+			}
+		} else if (self->used <= self->low) {
+			self->above = 0;
+			if (self->cb)
+				self->cb(self, 0);
+		}
+	}
+}
+
+static inline void cbufs_account(cbufs_t* self, ssize_t delta) {
+	self->length += delta;
+	if (self->budget)
+		cbudget_add(self->budget, delta);
+}
 
 cbufs_t* cbufs_init(cbufs_t* self) {
 	self->length = 0;
+	self->coalesce = 0;
+	self->budget = NULL;
 	cx_queue_init(&self->bufs);
 	return self;
 }
 
+void cbufs_set_budget(cbufs_t* self, cbudget_t* budget) {
+	if (self->budget)
+		cbudget_add(self->budget, -self->length);
+	self->budget = budget;
+	if (budget)
+		cbudget_add(budget, self->length);
+}
+
 cbufs_t* cbufs_fini(cbufs_t* self) {
 	if (self->length > 0) {
-		self->length = 0;
 		cx_queue_t *q, *q2;
+		cbufs_account(self, -self->length);
 		cx_queue_each2(q, q2, &self->bufs) {
 			struct cbufe_s* e = CX_GET_SELF(q, struct cbufe_s, qh);
-			cbuf_fini(&e->buf);
-			FREE(e);
+			cbufe_drop(e);
 		}
 		cx_queue_init(&self->bufs);
 	}
@@ -295,12 +416,12 @@ char* cbufs_base(cbufs_t* self, ssize_t n) {
 			cx_queue_t *q, *q2;
 			char* p = cbuf_init2(&solid->buf, n);
 			cx_queue_each2(q, q2, &self->bufs) {
-				e = CX_GET_SELF(head, struct cbufe_s, qh);
+				e = CX_GET_SELF(q, struct cbufe_s, qh);
+				l = e->buf.end - e->buf.start;
 				if (r >= l) {
 					cx_queue_remove0(q);
 					cbuf_copy(&e->buf, 0, l, p);
-					cbuf_fini(&e->buf);
-					FREE(e);
+					cbufe_drop(e);
 					p += l;
 					r -= l;
 					if (r == 0)
@@ -308,6 +429,7 @@ char* cbufs_base(cbufs_t* self, ssize_t n) {
 				} else {
 					cbuf_copy(&e->buf, 0, r, p);
 					e->buf.start += r;
+					break;
 				}
 			}
 
@@ -322,9 +444,9 @@ char* cbufs_base(cbufs_t* self, ssize_t n) {
 }
 
 void cbufs_swap(cbufs_t* self, cbufs_t* other) {
-	ssize_t length = self->length;
-	self->length = other->length;
-	other->length = length;
+	ssize_t delta = other->length - self->length;
+	cbufs_account(self, delta);
+	cbufs_account(other, -delta);
 	cx_queue_swap(&self->bufs, &other->bufs);
 }
 
@@ -334,22 +456,74 @@ static inline int cbuf_is_solid(cbuf_t* a, cbuf_t* b) {
 
 void cbufs_concat(cbufs_t* self, cbufs_t* other) {
 	if (other->length > 0) {
-		self->length += other->length;
+		cbufs_account(self, other->length);
+		cbufs_account(other, -other->length);
 		cx_queue_concat(&self->bufs, &other->bufs);
 	}
 }
 
+// copy small payloads into spare room of a tail buffer nobody else references
+static int cbufs_coalesce(cbufs_t* self, const char* data, ssize_t length) {
+	struct cbufe_s* e;
+	struct crbuf_s* raw;
+	ssize_t capacity;
+
+	if (length > self->coalesce)
+		return 0;
+
+	if (!cx_queue_empty(&self->bufs)) {
+		e = CX_GET_SELF(cx_queue_tail(&self->bufs), struct cbufe_s, qh);
+		raw = e->buf.raw;
+		if (raw->rc == (cbufe_is_inline(e) ? 2 : 1) && raw->length - e->buf.end >= length) {
+			memcpy(raw->data + e->buf.end, data, length);
+			e->buf.end += length;
+			cbufs_account(self, length);
+			return 1;
+		}
+	}
+
+	capacity = self->coalesce * 8;
+	if (capacity < CBUFS_COALESCE_CHUNK)
+		capacity = CBUFS_COALESCE_CHUNK;
+	raw = crbuf_new(capacity);
+	memcpy(raw->data, data, length);
+	e = CX_NEW(MALLOC, struct cbufe_s, 0);
+	e->buf.raw = raw;
+	e->buf.start = 0;
+	e->buf.end = length;
+
+	cbufs_account(self, length);
+	cx_queue_push(&self->bufs, &e->qh);
+	return 1;
+}
+
+void cbufs_set_coalesce(cbufs_t* self, ssize_t threshold) {
+	if (threshold > CBUFS_COALESCE_MAX)
+		threshold = CBUFS_COALESCE_MAX;
+	self->coalesce = threshold > 0 ? threshold : 0;
+}
+
 void cbufs_push(cbufs_t* self, cbuf_t* buf, int transfer_reference) {
-	if (buf->end > buf->start) {
-		struct cbufe_s* e = CX_GET_SELF(cx_queue_tail(&self->bufs), struct cbufe_s, qh);
-		self->length += (buf->end - buf->start);
-		if (cbuf_is_solid(&e->buf, buf)) {
-			e->buf.end = buf->end;
+	ssize_t length = buf->end - buf->start;
+	if (length > 0) {
+		if (!cx_queue_empty(&self->bufs)) {
+			struct cbufe_s* e = CX_GET_SELF(cx_queue_tail(&self->bufs), struct cbufe_s, qh);
+			if (cbuf_is_solid(&e->buf, buf)) {
+				e->buf.end = buf->end;
+				cbufs_account(self, length);
+				if (transfer_reference)
+					cbuf_fini(buf);
+				return;
+			}
+		}
+
+		if (cbufs_coalesce(self, buf->raw->data + buf->start, length)) {
 			if (transfer_reference)
 				cbuf_fini(buf);
 		} else {
-			e = CX_NEW(MALLOC, struct cbufe_s, 0);
+			struct cbufe_s* e = CX_NEW(MALLOC, struct cbufe_s, 0);
 			e->buf = cbuf_ref(buf, transfer_reference);
+			cbufs_account(self, length);
 			cx_queue_push(&self->bufs, &e->qh);
 		}
 	}
@@ -357,9 +531,11 @@ void cbufs_push(cbufs_t* self, cbuf_t* buf, int transfer_reference) {
 
 void cbufs_push_front(cbufs_t* self, cbuf_t* buf, int transfer_reference) {
 	if (buf->end > buf->start) {
-		struct cbufe_s* e = CX_GET_SELF(cx_queue_head(&self->bufs), struct cbufe_s, qh);
-		self->length += (buf->end - buf->start);
-		if (cbuf_is_solid(buf, &e->buf)) {
+		struct cbufe_s* e = NULL;
+		if (!cx_queue_empty(&self->bufs))
+			e = CX_GET_SELF(cx_queue_head(&self->bufs), struct cbufe_s, qh);
+		cbufs_account(self, buf->end - buf->start);
+		if (e && cbuf_is_solid(buf, &e->buf)) {
 			e->buf.start = buf->start;
 			if (transfer_reference)
 				cbuf_fini(buf);
@@ -371,6 +547,23 @@ void cbufs_push_front(cbufs_t* self, cbuf_t* buf, int transfer_reference) {
 	}
 }
 
+void cbufs_push_data(cbufs_t* self, const void* data, ssize_t length) {
+	assert(length >= 0 || data != NULL);
+	if (length < 0)
+		length = strlen((const char*)data);
+	if (length == 0 || cbufs_coalesce(self, (const char*)data, length)) {
+		// done
+	} else if (length > CBUFS_INLINE_MAX) {
+		cbuf_t buf;
+		cbuf_init(&buf, data, length);
+		cbufs_push(self, &buf, 1);
+	} else {
+		struct cbufe_s* e = cbufe_new_inline(data, length);
+		cbufs_account(self, length);
+		cx_queue_push(&self->bufs, &e->qh);
+	}
+}
+
 ssize_t cbufs_peek(cbufs_t* self, ssize_t n, cbuf_t* target) {
 	if (self->length == 0) {
 		target->start = target->end = 0;
@@ -379,19 +572,20 @@ ssize_t cbufs_peek(cbufs_t* self, ssize_t n, cbuf_t* target) {
 	} else {
 		cx_queue_t* head = cx_queue_head(&self->bufs);
 		struct cbufe_s* e = CX_GET_SELF(head, struct cbufe_s, qh);
-		int len = e->buf.end - e->buf.start;
+		ssize_t len = e->buf.end - e->buf.start;
 		if (n < 0 || n >= len) {
 			*target = e->buf;
 			cx_queue_remove0(head);
-			FREE(e);
-			self->length -= len;
+			cbufe_free(e);
+			cbufs_account(self, -len);
 			return len;
 		} else {
 			target->raw = e->buf.raw;
 			target->start = e->buf.start;
 			target->end = e->buf.start + n;
+			++target->raw->rc;
 			e->buf.start += n;
-			self->length -= n;
+			cbufs_account(self, -n);
 			return n;
 		}
 	}
@@ -412,8 +606,7 @@ ssize_t cbufs_shift(cbufs_t* self, ssize_t n, cbufs_t* target) {
 				if (target) {
 					cx_queue_push(&target->bufs, q);
 				} else {
-					cbuf_fini(&e->buf);
-					FREE(e);
+					cbufe_drop(e);
 				}
 				if (r == 0)
 					break;
@@ -422,7 +615,6 @@ ssize_t cbufs_shift(cbufs_t* self, ssize_t n, cbufs_t* target) {
 					struct cbufe_s* e2 = CX_NEW(MALLOC, struct cbufe_s, 0);
 					cbuf_shift(&e->buf, r, &e2->buf);
 					cx_queue_push(&target->bufs, &e2->qh);
-					target->length += r;
 				} else {
 					cbuf_shift(&e->buf, r, NULL);
 				}
@@ -430,7 +622,9 @@ ssize_t cbufs_shift(cbufs_t* self, ssize_t n, cbufs_t* target) {
 			}
 		}
 
-		self->length -= n;
+		cbufs_account(self, -n);
+		if (target)
+			cbufs_account(target, n);
 	}
 
 	return n;
@@ -450,8 +644,8 @@ ssize_t cbufs_shift_to(cbufs_t* self, ssize_t n, void* target) {
 				r -= l;
 				cx_queue_remove0(q);
 				memcpy(p, e->buf.raw->data + e->buf.start, l);
-				cbuf_fini(&e->buf);
-				FREE(e);
+				cbufe_drop(e);
+				p += l;
 				if (r == 0)
 					break;
 			} else {
@@ -461,7 +655,7 @@ ssize_t cbufs_shift_to(cbufs_t* self, ssize_t n, void* target) {
 			}
 		}
 
-		self->length -= n;
+		cbufs_account(self, -n);
 	}
 
 	return n;
@@ -479,9 +673,8 @@ ssize_t cbufs_shift_to_trunk(cbufs_t* self, ssize_t n, ctrunk_t* target) {
 			if (r >= l) {
 				r -= l;
 				cx_queue_remove0(q);
-				ctrunk_push(target, &e->buf, 1);
-				cbuf_fini(&e->buf);
-				FREE(e);
+				ctrunk_push(target, &e->buf, 0);
+				cbufe_drop(e);
 				if (r == 0)
 					break;
 			} else {
@@ -492,7 +685,7 @@ ssize_t cbufs_shift_to_trunk(cbufs_t* self, ssize_t n, ctrunk_t* target) {
 			}
 		}
 
-		self->length -= n;
+		cbufs_account(self, -n);
 	}
 
 	return n;
@@ -502,18 +695,18 @@ void cbufs_truncate(cbufs_t* self, ssize_t at) {
 	ssize_t r = (at < 0) ? -at : self->length - at;
 	if (r <= 0) {
 		// do nothing
-	} else if (r == self->length) {
+	} else if (r >= self->length) {
 		cbufs_fini(self);
 	} else {
 		cx_queue_t *q, *q2;
+		cbufs_account(self, -r);
 		cx_queue_reach2(q, q2, &self->bufs) {
 			struct cbufe_s* e = CX_GET_SELF(q, struct cbufe_s, qh);
 			ssize_t l = e->buf.end - e->buf.start;
 			if (r >= l) {
 				r -= l;
 				cx_queue_remove0(q);
-				cbuf_fini(&e->buf);
-				FREE(e);
+				cbufe_drop(e);
 				if (r == 0)
 					break;
 			} else {
@@ -524,10 +717,20 @@ void cbufs_truncate(cbufs_t* self, ssize_t at) {
 	}
 }
 
+cbufs_t* cbufs_escape(cbufs_t* self) {
+	cx_queue_t* q;
+	cx_queue_each(q, &self->bufs) {
+		struct cbufe_s* e = CX_GET_SELF(q, struct cbufe_s, qh);
+		cbuf_escape(&e->buf);
+	}
+
+	return self;
+}
+
 ssize_t cbufs_find(cbufs_t* self, int ch) {
 	ssize_t r = 0;
-	cx_queue_t *q, *q2;
-	cx_queue_reach2(q, q2, &self->bufs) {
+	cx_queue_t* q;
+	cx_queue_each(q, &self->bufs) {
 		struct cbufe_s* e = CX_GET_SELF(q, struct cbufe_s, qh);
 		ssize_t i = cbuf_find(&e->buf, ch);
 		if (i >= 0)
@@ -538,7 +741,183 @@ ssize_t cbufs_find(cbufs_t* self, int ch) {
 	return -1;
 }
 
-ctrunk_t* ctrunk_init(ctrunk_t* self, int cbufs) {
+ssize_t cbufs_split(cbufs_t* self, int ch, ssize_t max, cbufs_t* out) {
+	ssize_t k = 0;
+	ssize_t i;
+
+	// each search starts right after the previous delimiter, so only the
+	// trailing partial record is ever scanned twice across calls
+	while (k < max && (i = cbufs_find(self, ch)) >= 0) {
+		cbufs_shift(self, i, out + k);
+		cbufs_shift(self, 1, NULL);
+		++k;
+	}
+
+	return k;
+}
+
+ssize_t cbufs_split_buf(cbufs_t* self, int ch, ssize_t max, cbuf_t* out) {
+	ssize_t k = 0;
+	ssize_t i;
+
+	while (k < max && (i = cbufs_find(self, ch)) >= 0) {
+		cbuf_t* t = out + k;
+		struct cbufe_s* e = CX_GET_SELF(cx_queue_head(&self->bufs), struct cbufe_s, qh);
+		if (i == 0) {
+			t->raw = NULL;
+			t->start = t->end = 0;
+		} else if (i <= e->buf.end - e->buf.start) {
+			cbufs_peek(self, i, t);
+		} else {
+			// the record spans segments, only now is it copied
+			cbufs_shift_to(self, i, cbuf_init2(t, i));
+		}
+		cbufs_shift(self, 1, NULL);
+		++k;
+	}
+
+	return k;
+}
+
+static inline void cbufs_cursor_settle(cbufs_cursor_t* self) {
+	cx_queue_t* h = &self->bufs->bufs;
+	while (self->q != h) {
+		struct cbufe_s* e = CX_GET_SELF(self->q, struct cbufe_s, qh);
+		ssize_t l = e->buf.end - e->buf.start;
+		if (self->offset < l)
+			break;
+		self->offset -= l;
+		self->q = cx_queue_next(self->q);
+	}
+}
+
+cbufs_cursor_t* cbufs_cursor_init(cbufs_cursor_t* self, cbufs_t* bufs, ssize_t offset) {
+	if (offset < 0)
+		offset += bufs->length;
+	assert(offset >= 0 && offset <= bufs->length);
+	self->bufs = bufs;
+	self->q = cx_queue_head(&bufs->bufs);
+	self->offset = 0;
+	self->position = 0;
+	cbufs_cursor_skip(self, offset);
+	return self;
+}
+
+ssize_t cbufs_cursor_tell(cbufs_cursor_t* self) {
+	return self->position;
+}
+
+ssize_t cbufs_cursor_remain(cbufs_cursor_t* self) {
+	return self->bufs->length - self->position;
+}
+
+ssize_t cbufs_cursor_next(cbufs_cursor_t* self, ssize_t n, cx_buf_t* span) {
+	struct cbufe_s* e;
+	ssize_t l;
+
+	if (self->q == &self->bufs->bufs || n == 0) {
+		span->base = NULL;
+		span->len = 0;
+		return 0;
+	}
+
+	e = CX_GET_SELF(self->q, struct cbufe_s, qh);
+	l = e->buf.end - e->buf.start - self->offset;
+	if (n > 0 && n < l)
+		l = n;
+	span->base = e->buf.raw->data + e->buf.start + self->offset;
+	span->len = l;
+	self->offset += l;
+	self->position += l;
+	cbufs_cursor_settle(self);
+	return l;
+}
+
+ssize_t cbufs_cursor_next_ref(cbufs_cursor_t* self, ssize_t n, cbuf_t* target) {
+	struct cbufe_s* e;
+	ssize_t l;
+
+	if (self->q == &self->bufs->bufs || n == 0) {
+		target->raw = NULL;
+		target->start = target->end = 0;
+		return 0;
+	}
+
+	e = CX_GET_SELF(self->q, struct cbufe_s, qh);
+	l = e->buf.end - e->buf.start - self->offset;
+	if (n > 0 && n < l)
+		l = n;
+	*target = cbuf_mid(&e->buf, self->offset, l, 0);
+	self->offset += l;
+	self->position += l;
+	cbufs_cursor_settle(self);
+	return l;
+}
+
+int cbufs_cursor_peek(cbufs_cursor_t* self, ssize_t i) {
+	cx_queue_t* h = &self->bufs->bufs;
+	cx_queue_t* q = self->q;
+	ssize_t off = self->offset + i;
+
+	assert(i >= 0);
+	while (q != h) {
+		struct cbufe_s* e = CX_GET_SELF(q, struct cbufe_s, qh);
+		ssize_t l = e->buf.end - e->buf.start;
+		if (off < l)
+			return (unsigned char)e->buf.raw->data[e->buf.start + off];
+		off -= l;
+		q = cx_queue_next(q);
+	}
+
+	return -1;
+}
+
+ssize_t cbufs_cursor_skip(cbufs_cursor_t* self, ssize_t n) {
+	ssize_t remain = self->bufs->length - self->position;
+	if (n < 0 || n > remain)
+		n = remain;
+	self->offset += n;
+	self->position += n;
+	cbufs_cursor_settle(self);
+	return n;
+}
+
+ssize_t cbufs_cursor_read(cbufs_cursor_t* self, ssize_t n, void* target) {
+	char* p = (char*)target;
+	ssize_t r = 0;
+	cx_buf_t span;
+
+	if (n < 0)
+		n = self->bufs->length - self->position;
+	while (r < n && cbufs_cursor_next(self, n - r, &span) > 0) {
+		memcpy(p, span.base, span.len);
+		p += span.len;
+		r += span.len;
+	}
+
+	return r;
+}
+
+const char* cbufs_cursor_fetch(cbufs_cursor_t* self, ssize_t n, void* scratch) {
+	struct cbufe_s* e;
+
+	if (n <= 0 || n > self->bufs->length - self->position)
+		return NULL;
+
+	e = CX_GET_SELF(self->q, struct cbufe_s, qh);
+	if (e->buf.end - e->buf.start - self->offset >= n) {
+		const char* p = e->buf.raw->data + e->buf.start + self->offset;
+		self->offset += n;
+		self->position += n;
+		cbufs_cursor_settle(self);
+		return p;
+	}
+
+	cbufs_cursor_read(self, n, scratch);
+	return (const char*)scratch;
+}
+
+ctrunk_t* ctrunk_init(ctrunk_t* self, ssize_t cbufs) {
 	void* p = NULL;
 
 	if (cbufs > 0)
@@ -561,16 +940,28 @@ ctrunk_t* ctrunk_fini(ctrunk_t* self) {
 	return self;
 }
 
-ctrunk_t* ctrunk_clear(ctrunk_t* self) {
-	if (self->nbufs > 0) {
-		struct crbuf_s* p = (struct crbuf_s*)((void*)(self->bufs + self->cbufs));
-		struct crbuf_s* e = p + self->nbufs;
+static inline struct crbuf_s** ctrunk_raws(ctrunk_t* self) {
+	return (struct crbuf_s**)((void*)(self->bufs + self->cbufs));
+}
 
-		while (p != e) {
-			crbuf_unref(p);
+// drop the refs of entries [0, n), runs sharing one raw cost a single release
+static void ctrunk_release(ctrunk_t* self, ssize_t n) {
+	struct crbuf_s** p = ctrunk_raws(self);
+	struct crbuf_s** e = p + n;
+
+	while (p != e) {
+		struct crbuf_s* raw = *p++;
+		while (p != e && *p == raw) {
+			--raw->rc;
 			++p;
 		}
+		crbuf_unref(raw);
+	}
+}
 
+ctrunk_t* ctrunk_clear(ctrunk_t* self) {
+	if (self->nbufs > 0) {
+		ctrunk_release(self, self->nbufs);
 		self->nbufs = 0;
 		self->length = 0;
 	}
@@ -578,30 +969,83 @@ ctrunk_t* ctrunk_clear(ctrunk_t* self) {
 	return self;
 }
 
+ssize_t ctrunk_consume(ctrunk_t* self, ssize_t n) {
+	struct crbuf_s** raws = ctrunk_raws(self);
+	ssize_t i = 0;
+
+	if (n < 0 || n > self->length)
+		n = self->length;
+	self->length -= n;
+
+	while (i < self->nbufs && (size_t)n >= self->bufs[i].len) {
+		n -= self->bufs[i].len;
+		++i;
+	}
+
+	if (i > 0) {
+		ctrunk_release(self, i);
+		self->nbufs -= i;
+		memmove(self->bufs, self->bufs + i, sizeof(cx_buf_t) * self->nbufs);
+		memmove(raws, raws + i, sizeof(struct crbuf_s*) * self->nbufs);
+	}
+
+	if (n > 0) {
+		self->bufs[0].base += n;
+		self->bufs[0].len -= n;
+	}
+
+	return self->length;
+}
+
+ssize_t ctrunk_batch(ctrunk_t* self, cx_buf_t** bufs) {
+	*bufs = self->bufs;
+	return self->nbufs < CTRUNK_BATCH_MAX ? self->nbufs : CTRUNK_BATCH_MAX;
+}
+
 int ctrunk_push(ctrunk_t* self, cbuf_t* buf, int transfer_reference) {
 	struct crbuf_s** raws;
 	cx_buf_t* b;
+	ssize_t length = cbuf_length(buf);
+
+	if (length > CX_BUF_LEN_MAX) {
+		ssize_t off;
+		for (off = 0; off < length; off += CX_BUF_LEN_MAX) {
+			ssize_t n = length - off;
+			cbuf_t piece = cbuf_mid(buf, off, n < CX_BUF_LEN_MAX ? n : CX_BUF_LEN_MAX, 0);
+			ctrunk_push(self, &piece, 1);
+		}
+		if (transfer_reference)
+			cbuf_fini(buf);
+		return 0;
+	}
+
+	if (length == 0) {
+		if (transfer_reference)
+			cbuf_fini(buf);
+		return 0;
+	}
 
 	if (self->nbufs == self->cbufs) {
-		int cbufs = self->cbufs ? (self->cbufs * 2) : 4;
+		ssize_t cbufs = self->cbufs ? (self->cbufs * 2) : 4;
 		cx_buf_t* bufs = (cx_buf_t*)REALLOC(self->bufs, (sizeof(cx_buf_t) + sizeof(struct crbuf_s*)) * cbufs);
 		raws = (struct crbuf_s**)((void*)(bufs + cbufs));
-		if (self->cbufs > 0) {
-			struct crbuf_s* old_raws = (struct crbuf_s*)((void*)(bufs + self->cbufs));
-			memmove(raws, old_raws, self->cbufs);
+		if (self->nbufs > 0) {
+			struct crbuf_s** old_raws = (struct crbuf_s**)((void*)(bufs + self->cbufs));
+			memmove(raws, old_raws, sizeof(struct crbuf_s*) * self->nbufs);
 		}
 
 		self->bufs = bufs;
 		self->cbufs = cbufs;
 	} else {
-		raws = (struct crbuf_s**)((void*)(self->bufs + self->cbufs));
+		raws = ctrunk_raws(self);
 	}
 
 	b = self->bufs + self->nbufs;
 	b->base = cbuf_base(buf);
-	b->len = cbuf_length(buf);
+	b->len = length;
 	raws[self->nbufs] = buf->raw;
 	++self->nbufs;
+	self->length += length;
 
 	if (transfer_reference) {
 		buf->raw = NULL;
@@ -7,34 +7,248 @@
 typedef struct cbuf_s cbuf_t;
 typedef struct cbufs_s cbufs_t;
 typedef struct ctrunk_s ctrunk_t;
+typedef struct cbufs_cursor_s cbufs_cursor_t;
+typedef struct cbudget_s cbudget_t;
+typedef struct carena_s carena_t;
+typedef struct cbuilder_s cbuilder_t;
+typedef struct cbuf_reduce_s cbuf_reduce_t;
+typedef struct ccodec_s ccodec_t;
+typedef struct cutf8_s cutf8_t;
+typedef struct cxxh64_s cxxh64_t;
+typedef struct clz_s clz_t;
+typedef struct ccache_s ccache_t;
+typedef struct coutq_s coutq_t;
+typedef struct coutq_stats_s coutq_stats_t;
+typedef struct cpool_stats_s cpool_stats_t;
+typedef struct csnap_s csnap_t;
 
 struct cbuf_s {
 	struct crbuf_s* raw;
-	int start;
-	int end;
+	ssize_t start;
+	ssize_t end;
 };
 
 #define CBUF_ZERO(x) {NULL, 0, 0}
 
 struct cbufs_s {
 	ssize_t length;
+	ssize_t coalesce;
+	cbudget_t* budget;
 	cx_queue_t bufs;
 };
 
-#define CBUFS_ZERO(x) {0, CX_QUEUE_ZERO((x).bufs)}
+#define CBUFS_ZERO(x) {0, 0, NULL, CX_QUEUE_ZERO((x).bufs)}
+
+// byte budget shared by any number of cbufs_t, cb fires when used reaches
+// high and again when it drops back to low; parent budgets see every change
+struct cbudget_s {
+	ssize_t used;
+	ssize_t high;
+	ssize_t low;
+	int above;
+	void (*cb)(cbudget_t* self, int above);
+	void* data;
+	cbudget_t* parent;
+};
+
+#define CBUDGET_ZERO(x) {0, 0, 0, 0, NULL, NULL, NULL}
+
+// read-only position inside a cbufs_t, invalidated by any change to the chain
+struct cbufs_cursor_s {
+	cbufs_t* bufs;
+	cx_queue_t* q;
+	ssize_t offset;
+	ssize_t position;
+};
+
+// most entries one gather write may take, see ctrunk_batch
+#ifdef IOV_MAX
+# define CTRUNK_BATCH_MAX IOV_MAX
+#else
+# define CTRUNK_BATCH_MAX 1024
+#endif
 
 struct ctrunk_s {
-	int cbufs;
-	int nbufs;
+	ssize_t cbufs;
+	ssize_t nbufs;
 	ssize_t length;
 	cx_buf_t* bufs;
 };
 
+// bump allocator for buffers sharing one lifetime, see carena_use
+struct carena_s {
+	ssize_t chunk_size;
+	ssize_t live;
+	struct carena_chunk_s* head;
+	struct carena_chunk_s* cur;
+};
+
+// append-only writer growing geometrically into fresh chunks
+struct cbuilder_s {
+	cbufs_t bufs;
+	cbuf_t cur;
+	ssize_t chunk;
+};
+
+// element types understood by cbuf_reduce
+enum {
+	CBUF_INT8 = 1,
+	CBUF_UINT8,
+	CBUF_INT16,
+	CBUF_UINT16,
+	CBUF_INT32,
+	CBUF_UINT32,
+	CBUF_INT64,
+	CBUF_UINT64,
+	CBUF_FLOAT32,
+	CBUF_FLOAT64,
+};
+
+// min and max use i for signed, u for unsigned and f for float types.
+// Integer sums add in u and wrap modulo 2^64, read i for a signed result.
+// NaNs never count towards a float min or max, which stay at +inf and -inf
+// when there is no other value
+struct cbuf_reduce_s {
+	ssize_t count;
+	union { int64_t i; uint64_t u; double f; } sum, min, max;
+};
+
+enum {
+	CCODEC_BASE64_ENCODE = 1,
+	CCODEC_BASE64_DECODE,
+	CCODEC_HEX_ENCODE,
+	CCODEC_HEX_DECODE,
+};
+
+// streaming base64/hex state, carries a partial unit between updates
+struct ccodec_s {
+	int kind;
+	int state;
+	int ncarry;
+	unsigned char carry[4];
+};
+
+// incremental UTF-8 validator, offsets count from the first byte fed
+struct cutf8_s {
+	ssize_t offset;
+	ssize_t start;
+	int remain;
+	unsigned lo;
+	unsigned hi;
+};
+
+// streaming xxHash64 state
+struct cxxh64_s {
+	uint64_t total;
+	uint64_t v[4];
+	uint64_t seed;
+	unsigned nmem;
+	unsigned char mem[32];
+};
+
+enum {
+	CLZ_COMPRESS = 1,
+	CLZ_DECOMPRESS,
+};
+
+// streaming block compressor state, buf holds at most one block
+struct clz_s {
+	int kind;
+	int state;
+	ssize_t nbuf;
+	ssize_t need;
+	uint32_t header;
+	int nheader;
+	unsigned char hbuf[4];
+	unsigned char* buf;
+};
+
+// content-addressed store sharing one crbuf per distinct payload, entries
+// stay in lru order and are evicted once only the cache references them
+struct ccache_s {
+	ssize_t limit;
+	ssize_t size;
+	ssize_t count;
+	ssize_t nslots;
+	struct ccache_entry_s** slots;
+	cx_queue_t lru;
+	// entries found still referenced elsewhere while trimming, kept off the
+	// LRU until a rescan finds them released
+	cx_queue_t pinned;
+	ssize_t npinned;
+	ssize_t pin_credit;
+	ssize_t hits;
+	ssize_t misses;
+	ssize_t evictions;
+};
+
+// gather writer, returns bytes written or -1 with errno set (EAGAIN when
+// the target would block)
+typedef ssize_t (*coutq_write_cb)(void* data, cx_buf_t* bufs, int n);
+
+// writes counts coutq_push calls, saved is writes minus syscalls, delays
+// are in the caller's time unit and summed over writes
+struct coutq_stats_s {
+	ssize_t writes;
+	ssize_t flushes;
+	ssize_t syscalls;
+	ssize_t blocked;
+	ssize_t saved;
+	ssize_t bytes;
+	int64_t delay_total;
+	int64_t delay_max;
+};
+
+// write-combining output queue, flushed once per tick or when a limit is hit
+struct coutq_s {
+	cbufs_t pending;
+	ctrunk_t trunk;
+	ssize_t max_bytes;
+	ssize_t max_writes;
+	int64_t max_delay;
+	ssize_t npending;
+	int64_t first;
+	int64_t time_sum;
+	coutq_write_cb write;
+	void* data;
+	coutq_stats_t stats;
+};
+
+enum {
+	CPOOL_ENABLE = 1,
+	CPOOL_HUGEPAGE = 2,
+	CPOOL_THP = 4,
+	CPOOL_NUMA = 8,
+};
+
+// a snapshot mapped and validated by csnap_open, until csnap_attach
+struct csnap_s {
+	struct csnap_map_s* map;
+	int nchains;
+};
+
+struct cpool_stats_s {
+	int flags;
+	ssize_t min_size;
+	ssize_t allocs;
+	// with CPOOL_NUMA, allocations whose pages sit on the calling thread's
+	// node or on another one; borrowed blocks came from another node's list
+	ssize_t local;
+	ssize_t remote;
+	ssize_t borrowed;
+	ssize_t used;
+	ssize_t mapped;
+	ssize_t regions;
+	ssize_t huge_regions;
+	ssize_t remote_regions;
+};
+
 CX_API cbuf_t*   cbuf_init(cbuf_t* self, const void* data, ssize_t length);
 CX_API char*     cbuf_init2(cbuf_t* self, ssize_t length);
 CX_API cbuf_t*   cbuf_fini(cbuf_t* self);
 CX_API ssize_t   cbuf_length(cbuf_t* self);
 CX_API char*     cbuf_base(cbuf_t* self);
+CX_API int       cbuf_readonly(cbuf_t* self);
 CX_API void      cbuf_swap(cbuf_t* self, cbuf_t* other);
 CX_API cbuf_t    cbuf_ref(cbuf_t* self, int transfer_reference);
 CX_API cbuf_t    cbuf_slice(cbuf_t* self, ssize_t start, ssize_t end, int transfer_reference);
@@ -43,27 +257,121 @@ CX_API ssize_t   cbuf_copy(cbuf_t* self, ssize_t start, ssize_t n, void* target)
 CX_API ssize_t   cbuf_shift(cbuf_t* self, ssize_t n, cbuf_t* target);
 CX_API ssize_t   cbuf_pop(cbuf_t* self, ssize_t n, cbuf_t* target);
 CX_API ssize_t   cbuf_find(cbuf_t* self, int ch);
+CX_API cbuf_t*   cbuf_escape(cbuf_t* self);
 
 CX_API cbufs_t*  cbufs_init(cbufs_t* self);
 CX_API cbufs_t*  cbufs_fini(cbufs_t* self);
 CX_API ssize_t   cbufs_length(cbufs_t* self);
 CX_API char*     cbufs_base(cbufs_t* self, ssize_t n);
 CX_API void      cbufs_swap(cbufs_t* self, cbufs_t* other);
+CX_API void      cbufs_set_coalesce(cbufs_t* self, ssize_t threshold);
+CX_API void      cbufs_set_budget(cbufs_t* self, cbudget_t* budget);
 CX_API void      cbufs_concat(cbufs_t* self, cbufs_t* other);
 CX_API void      cbufs_push(cbufs_t* self, cbuf_t* buf, int transfer_reference);
 CX_API void      cbufs_push_front(cbufs_t* self, cbuf_t* buf, int transfer_reference);
+CX_API void      cbufs_push_data(cbufs_t* self, const void* data, ssize_t length);
 CX_API ssize_t   cbufs_peek(cbufs_t* self, ssize_t n, cbuf_t* target);
 CX_API ssize_t   cbufs_shift(cbufs_t* self, ssize_t n, cbufs_t* target);
 CX_API ssize_t   cbufs_shift_to(cbufs_t* self, ssize_t n, void* target);
 CX_API ssize_t   cbufs_shift_to_trunk(cbufs_t* self, ssize_t n, ctrunk_t* target);
 CX_API void      cbufs_truncate(cbufs_t* self, ssize_t n);
 CX_API ssize_t   cbufs_find(cbufs_t* self, int ch);
+CX_API ssize_t   cbufs_split(cbufs_t* self, int ch, ssize_t max, cbufs_t* out);
+CX_API ssize_t   cbufs_split_buf(cbufs_t* self, int ch, ssize_t max, cbuf_t* out);
+CX_API cbufs_t*  cbufs_escape(cbufs_t* self);
 //CX_API void      cbufs_solidify(cbufs_t* self, ssize_t start, ssize_t end, cbuf_t* target);
 
-CX_API ctrunk_t* ctrunk_init(ctrunk_t* self, int cbufs);
+CX_API cbufs_cursor_t* cbufs_cursor_init(cbufs_cursor_t* self, cbufs_t* bufs, ssize_t offset);
+CX_API ssize_t   cbufs_cursor_tell(cbufs_cursor_t* self);
+CX_API ssize_t   cbufs_cursor_remain(cbufs_cursor_t* self);
+CX_API ssize_t   cbufs_cursor_next(cbufs_cursor_t* self, ssize_t n, cx_buf_t* span);
+CX_API ssize_t   cbufs_cursor_next_ref(cbufs_cursor_t* self, ssize_t n, cbuf_t* target);
+CX_API int       cbufs_cursor_peek(cbufs_cursor_t* self, ssize_t i);
+CX_API ssize_t   cbufs_cursor_skip(cbufs_cursor_t* self, ssize_t n);
+CX_API ssize_t   cbufs_cursor_read(cbufs_cursor_t* self, ssize_t n, void* target);
+CX_API const char* cbufs_cursor_fetch(cbufs_cursor_t* self, ssize_t n, void* scratch);
+
+CX_API cbudget_t* cbudget_init(cbudget_t* self, ssize_t high, ssize_t low, cbudget_t* parent);
+CX_API void      cbudget_add(cbudget_t* self, ssize_t delta);
+
+CX_API ctrunk_t* ctrunk_init(ctrunk_t* self, ssize_t cbufs);
 CX_API ctrunk_t* ctrunk_fini(ctrunk_t* self);
 CX_API ctrunk_t* ctrunk_clear(ctrunk_t* self);
 CX_API int       ctrunk_push(ctrunk_t* self, cbuf_t* buf, int transfer_reference);
+CX_API ssize_t   ctrunk_consume(ctrunk_t* self, ssize_t n);
+CX_API ssize_t   ctrunk_batch(ctrunk_t* self, cx_buf_t** bufs);
+
+CX_API carena_t* carena_init(carena_t* self, ssize_t chunk_size);
+CX_API carena_t* carena_fini(carena_t* self);
+CX_API carena_t* carena_reset(carena_t* self);
+CX_API carena_t* carena_use(carena_t* self);
+
+CX_API cbuilder_t* cbuilder_init(cbuilder_t* self, ssize_t hint);
+CX_API cbuilder_t* cbuilder_fini(cbuilder_t* self);
+CX_API ssize_t   cbuilder_length(cbuilder_t* self);
+CX_API char*     cbuilder_reserve(cbuilder_t* self, ssize_t n);
+CX_API void      cbuilder_commit(cbuilder_t* self, ssize_t n);
+CX_API void      cbuilder_write(cbuilder_t* self, const void* data, ssize_t length);
+CX_API void      cbuilder_append(cbuilder_t* self, cbuf_t* buf, int transfer_reference);
+CX_API void      cbuilder_varint(cbuilder_t* self, uint64_t v);
+CX_API void      cbuilder_finish(cbuilder_t* self, cbufs_t* target);
+CX_API void      cbuilder_finish_buf(cbuilder_t* self, cbuf_t* target);
+
+CX_API void      cbuf_bswap(void* target, const void* source, ssize_t count, int width);
+CX_API void      cbuf_reduce(const void* data, ssize_t count, int type, int swap, cbuf_reduce_t* r);
+
+CX_API ccodec_t* ccodec_init(ccodec_t* self, int kind);
+CX_API int       ccodec_update(ccodec_t* self, const void* data, ssize_t length, cbuilder_t* target);
+CX_API int       ccodec_finish(ccodec_t* self, cbuilder_t* target);
+CX_API ssize_t   cbufs_transcode(cbufs_t* self, ssize_t start, ssize_t n, int kind, cbuilder_t* target);
+
+CX_API cutf8_t*  cutf8_init(cutf8_t* self);
+CX_API ssize_t   cutf8_update(cutf8_t* self, const void* data, ssize_t length);
+CX_API ssize_t   cutf8_finish(cutf8_t* self);
+CX_API ssize_t   cbufs_utf8_check(cbufs_t* self, ssize_t start, ssize_t n);
+
+CX_API uint32_t  ccrc32c_update(uint32_t crc, const void* data, ssize_t length);
+CX_API uint32_t  ccrc32c_combine(uint32_t crc1, uint32_t crc2, ssize_t length2);
+CX_API uint32_t  cbufs_crc32c(cbufs_t* self, ssize_t start, ssize_t n, uint32_t crc);
+CX_API cxxh64_t* cxxh64_init(cxxh64_t* self, uint64_t seed);
+CX_API void      cxxh64_update(cxxh64_t* self, const void* data, ssize_t length);
+CX_API uint64_t  cxxh64_digest(const cxxh64_t* self);
+CX_API uint64_t  cbufs_xxh64(cbufs_t* self, ssize_t start, ssize_t n, uint64_t seed);
+CX_API int       chash_configure(int threads, ssize_t min_size);
+CX_API int       chash_get_threads(ssize_t* min_size);
+
+CX_API clz_t*    clz_init(clz_t* self, int kind);
+CX_API clz_t*    clz_fini(clz_t* self);
+CX_API int       clz_update(clz_t* self, const void* data, ssize_t length, cbuilder_t* target);
+CX_API int       clz_finish(clz_t* self, cbuilder_t* target);
+CX_API ssize_t   cbufs_lz(cbufs_t* self, ssize_t start, ssize_t n, int kind, cbuilder_t* target);
+
+CX_API ccache_t* ccache_init(ccache_t* self, ssize_t limit);
+CX_API ccache_t* ccache_fini(ccache_t* self);
+CX_API int       ccache_put(ccache_t* self, cbuf_t* buf, cbuf_t* target);
+CX_API int       ccache_put_data(ccache_t* self, const void* data, ssize_t length, cbuf_t* target);
+CX_API int       ccache_put_bufs(ccache_t* self, cbufs_t* bufs, ssize_t start, ssize_t n, cbuf_t* target);
+CX_API int       ccache_get(ccache_t* self, uint64_t hash, cbuf_t* target);
+CX_API ssize_t   ccache_trim(ccache_t* self, ssize_t limit);
+
+CX_API int       csnap_save(const char* path, cbufs_t** chains, int nchains);
+CX_API int       csnap_load(const char* path, cbufs_t** chains, int nchains);
+CX_API int       csnap_open(csnap_t* self, const char* path);
+CX_API void      csnap_attach(csnap_t* self, cbufs_t** chains, int nchains);
+
+CX_API coutq_t*  coutq_init(coutq_t* self, coutq_write_cb write, void* data);
+CX_API coutq_t*  coutq_fini(coutq_t* self);
+CX_API void      coutq_set_limits(coutq_t* self, ssize_t max_bytes, ssize_t max_writes, int64_t max_delay);
+CX_API ssize_t   coutq_length(coutq_t* self);
+CX_API int       coutq_push(coutq_t* self, cbuf_t* buf, int transfer_reference, int64_t now);
+CX_API int       coutq_push_data(coutq_t* self, const void* data, ssize_t length, int64_t now);
+CX_API int       coutq_flush(coutq_t* self, int64_t now);
+CX_API int       coutq_tick(coutq_t* self, int64_t now);
+CX_API int64_t   coutq_deadline(coutq_t* self);
+CX_API void      coutq_get_stats(coutq_t* self, coutq_stats_t* stats);
+
+CX_API int       cpool_configure(int flags, ssize_t min_size);
+CX_API void      cpool_get_stats(cpool_stats_t* stats);
 
 #endif
 
@@ -0,0 +1,38 @@
+#ifndef __CRBUF_H__
+#define __CRBUF_H__
+
+#include "cbuf.h"
+
+#ifndef MALLOC
+# define MALLOC(n) malloc(n)
+# define REALLOC(p, n) realloc(p, n)
+# define FREE(p) free(p)
+#endif
+
+enum {
+	CRBUF_INLINE = 1,
+	CRBUF_ARENA = 2,
+	CRBUF_POOL = 4,
+	CRBUF_MAPPED = 8,
+	CRBUF_READONLY = 16,
+};
+
+struct crbuf_s {
+	int     rc;
+	int     flags;
+	ssize_t length;
+	char    data[1];
+};
+
+CX_API struct crbuf_s* crbuf_new(ssize_t length);
+CX_API void            crbuf_unref(struct crbuf_s* self);
+
+CX_API struct crbuf_s* carena_crbuf_new(ssize_t length);
+CX_API void            carena_crbuf_free(struct crbuf_s* raw);
+
+CX_API struct crbuf_s* cpool_crbuf_new(ssize_t length);
+CX_API void            cpool_crbuf_free(struct crbuf_s* raw);
+
+CX_API void            csnap_crbuf_free(struct crbuf_s* raw);
+
+#endif
@@ -6,6 +6,7 @@
 #endif
 
 #include <sys/types.h>
+#include <limits.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -28,6 +29,22 @@ typedef struct {
 } cx_buf_t;
 #endif
 
+#ifdef _WIN32
+# define CX_BUF_LEN_MAX ((ssize_t)0xffffffffUL)
+#else
+# define CX_BUF_LEN_MAX SSIZE_MAX
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+# define CX_IS_BIG_ENDIAN
+#endif
+
+#ifdef _MSC_VER
+# define CX_THREAD_LOCAL __declspec(thread)
+#else
+# define CX_THREAD_LOCAL __thread
+#endif
+
 #define CX_NEW(malloc, type, xlen) (type*)malloc(sizeof(type) + xlen)
 #define CX_NEW2(malloc, type, member, xlen) (type*)malloc(offsetof(type, member) + xlen)
 #define CX_GET_SELF(ptr, type, member) ((type*)((char*)((void*)(ptr)) - offsetof(type, member)))
@@ -67,8 +67,14 @@ typedef struct cx_queue_s {
 	cx_queue_t __t = *__h; \
 	*__h = *__h2; \
 	*__h2 = __t; \
-	__h->prev->next = __h->next->prev = __h; \
-	__h2->prev->next = __h2->next->prev = __h2; \
+	if (__h->next == __h2) \
+		__h->next = __h->prev = __h; \
+	else \
+		__h->prev->next = __h->next->prev = __h; \
+	if (__h2->next == __h) \
+		__h2->next = __h2->prev = __h2; \
+	else \
+		__h2->prev->next = __h2->next->prev = __h2; \
 } while (0)
 
 #define cx_queue_each(e, h) for (e = (h)->next; e != (h); e = e->next)
@@ -11,3 +11,243 @@ cbuf.append(bl, b)
 print("#b", #b)
 print("#bl", #bl)
 print("b.tostring", cbuf.tostring(b))
+for b, off in cbuf.each(bl) do
+	print("each", off, cbuf.tostring(b))
+end
+local eparts = {}
+for b, off in cbuf.each(bl, 7) do eparts[#eparts + 1] = off .. ":" .. cbuf.tostring(b) end
+assert(table.concat(eparts, ",") == "7:bc", "each from two segments in")
+local mq = cbuf.bufs()
+for i = 1, 4 do cbuf.append(mq, "seg" .. i) end
+local seen = {}
+for b in cbuf.each(mq) do
+	seen[#seen + 1] = cbuf.tostring(b)
+	cbuf.skip(mq, 4)
+end
+assert(table.concat(seen, ",") == "seg1,seg3", "each while the chain is consumed")
+cbuf.append(bl, "ack\n")
+print("#bl", #bl, cbuf.find(bl, "\n"))
+local cl = cbuf.bufs(64)
+for i = 1, 10 do cbuf.append(cl, "ping" .. i .. "\n") end
+local segs = 0
+for _ in cbuf.each(cl) do segs = segs + 1 end
+print("#cl", #cl, "segments", segs)
+local hl = cbuf.bufs(2^61)
+cbuf.append(hl, "tiny")
+assert(#hl == 4, "oversized coalesce threshold")
+local wl = cbuf.bufs()
+cbuf.watermark(wl, 8, 4)
+cbuf.append(wl, "0123456789")
+print("paused", cbuf.paused(wl))
+cbuf.skip(wl, 8)
+print("paused", cbuf.paused(wl))
+local gl = cbuf.bufs()
+assert(cbuf.watermark(1000000, 500000) == false, "state-wide watermark")
+cbuf.append(gl, string.rep("x", 1000000))
+assert(cbuf.paused() and cbuf.paused(wl), "state-wide watermark reached")
+cbuf.skip(gl, 1000000)
+assert(not cbuf.paused() and cbuf.watermark(0) == false, "state-wide watermark released")
+assert(cbuf.struct("<LH") == cbuf.struct("<LH"), "struct interned")
+local pb = cbuf.buf(6)
+cbuf.pack(pb, 0, "<LH", 7, 9)
+local pu1, pu2 = cbuf.unpack(pb, 0, "<LH")
+assert(pu1 == 7 and pu2 == 9 and cbuf.tostring(pb) == "\7\0\0\0\9\0", "unpack fmt")
+local bd = cbuf.builder()
+cbuf.put(bd, "<LH", 1, 2)
+cbuf.varint(bd, 300)
+cbuf.write(bd, "payload")
+assert(#bd == 15, "#builder")
+local fb = cbuf.finish(bd, "buf")
+local fu1, fu2 = cbuf.unpack(fb, 0, "<LH")
+assert(#fb == 15 and fu1 == 1 and fu2 == 2 and cbuf.tostring(fb, 6, 9) == "\172\2payload", "finish")
+local zb = cbuf.builder()
+cbuf.put(zb, "s4z3s#z#", "ab", "x", 3, "y", 2, "")
+assert(cbuf.tostring(cbuf.finish(zb, "buf")) == "ab\0\0x\0\0\0y\0\0\0\0\0", "string padding")
+print("bufs.tostring", cbuf.tostring(bl), cbuf.tostring(bl, 2, 5), #bl)
+local dq = cbuf.bufs()
+local dc = cbuf.decoder("<HH", dq)
+cbuf.append(dq, "\1\0\2\0\3")
+local recs, nrec = cbuf.decode(dc)
+assert(nrec == 1 and recs[1][1] == 1 and recs[1][2] == 2 and #dc == 1, "decode")
+cbuf.append(dq, "\0\4\0")
+recs, nrec = cbuf.decode(dc)
+assert(nrec == 1 and recs[1][1] == 3 and recs[1][2] == 4 and #dc == 0, "decode resumed")
+local ab = cbuf.buf(16)
+cbuf.pack(ab, 0, ">L4", {1, 2, 3, 4})
+local av = cbuf.unpack(ab, 0, ">L4")
+assert(#av == 4 and av[1] == 1 and av[4] == 4 and cbuf.tostring(ab, 0, 4) == "\0\0\0\1", "array")
+local dv = cbuf.unpack(ab, 0, ">H#", 8)
+assert(#dv == 8 and dv[2] == 1 and dv[8] == 4, "counted array")
+assert(not pcall(cbuf.pack, ab, 0, ">L4", {1, 2, "x", 4}), "array element not a number")
+assert(not pcall(cbuf.pack, ab, 0, ">Q#", 2^61, {}), "counted array too long")
+assert(not pcall(cbuf.struct, "L99999999999"), "repeat count too large")
+local ta = cbuf.array(ab, ">L")
+print("typed array", #ta, ta[1], ta[4], cbuf.sum(ta), cbuf.min(ta), cbuf.max(ta))
+ta[2] = 40
+local tv = ta(2, 3)
+print("typed slice", #tv, tv[1], cbuf.sum(tv))
+assert(#ta(9, 12) == 0 and #ta(5) == 0, "slice past the end")
+assert(not pcall(cbuf.array, ab, ">L", 0, 2^62), "array count overflow")
+local nan = 0 / 0
+local function farray(fmt, vals)
+	local fb = cbuf.buf(8 * #vals)
+	cbuf.pack(fb, 0, fmt .. "#", #vals, vals)
+	return cbuf.array(fb, fmt, 0, #vals)
+end
+for _, fmt in ipairs({"<d", ">d", "<f"}) do
+	for _, vals in ipairs({{nan, 1, 2, 3}, {1, nan, 2, 3}, {1, 2, 3, nan}}) do
+		local fa = farray(fmt, vals)
+		assert(cbuf.min(fa) == 1 and cbuf.max(fa) == 3, "NaN skipped by min/max " .. fmt)
+	end
+	assert(cbuf.min(farray(fmt, {nan, nan})) == nil, "only NaNs " .. fmt)
+end
+local longf = {}
+for i = 1, 1100 do longf[i] = i end
+longf[1], longf[700], longf[1100] = nan, nan, nan
+local fa = farray(">d", longf)
+assert(cbuf.min(fa) == 2 and cbuf.max(fa) == 1099 and cbuf.sum(fa) ~= cbuf.sum(fa), "NaN in any chunk")
+assert(cbuf.sum(farray("<q", {2^62, 2^62, 2^62, 2^62, 5})) == 5, "int64 sum wraps")
+local b64 = cbuf.tobase64("hello world")
+print("base64", cbuf.tostring(b64), cbuf.tostring(cbuf.frombase64(b64)))
+print("hex", cbuf.tostring(cbuf.tohex(bl)), cbuf.frombase64("@@@@"))
+local function splitbufs(s, sizes)
+	local out, pos, k = cbuf.bufs(), 1, 1
+	while pos <= #s do
+		local n = sizes[(k - 1) % #sizes + 1]
+		local chunk = s:sub(pos, pos + n - 1)
+		local seg = cbuf.buf(#chunk)
+		cbuf.pack(seg, 0, "s" .. #chunk, chunk)
+		cbuf.append(out, seg)
+		pos, k = pos + n, k + 1
+	end
+	return out
+end
+local function refbase64(s)
+	local alpha = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"
+	local out = {}
+	for i = 1, #s, 3 do
+		local a, b, c = s:byte(i, i + 2)
+		local v = a * 65536 + (b or 0) * 256 + (c or 0)
+		local q = {}
+		for k = 1, 4 do
+			local d = math.floor(v / 2 ^ (6 * (4 - k))) % 64
+			q[k] = alpha:sub(d + 1, d + 1)
+		end
+		if not c then q[4] = "=" end
+		if not b then q[3] = "=" end
+		out[#out + 1] = table.concat(q)
+	end
+	return table.concat(out)
+end
+local cbytes = {}
+for i = 1, 301 do cbytes[i] = string.char((i * 37 + 11) % 256) end
+local craw = table.concat(cbytes)
+local craw_hex = craw:gsub(".", function(c) return string.format("%02x", c:byte()) end)
+local craw_b64 = refbase64(craw)
+local csegs = splitbufs(craw, {1, 5, 17, 70, 2, 33})
+local nsegs = 0
+for _ in cbuf.each(csegs) do nsegs = nsegs + 1 end
+assert(#csegs == #craw and nsegs > 8, "split codec input")
+assert(cbuf.tostring(cbuf.tobase64(csegs)) == craw_b64, "segmented base64 encode")
+assert(cbuf.tostring(cbuf.tohex(csegs)) == craw_hex, "segmented hex encode")
+assert(cbuf.tostring(cbuf.frombase64(splitbufs(craw_b64, {3, 66, 1, 9}))) == craw, "segmented base64 decode")
+assert(cbuf.tostring(cbuf.fromhex(splitbufs(craw_hex, {3, 66, 1, 9}))) == craw, "segmented hex decode")
+print("utf8check", cbuf.utf8check("h\195\169llo"), cbuf.utf8check("ab\237\160\128"), cbuf.utf8check(bl))
+local utext = ("h\195\169llo \226\130\172 \240\159\152\128 w\195\182rld "):rep(3)
+local ubad = utext:sub(1, 40) .. "\237\160\128" .. utext:sub(41)
+for cut = 1, #utext - 1 do
+	local parts = splitbufs(utext, {cut, #utext})
+	assert(cbuf.utf8check(parts) == -1, "utf8 split at " .. cut)
+	local st = cbuf.utf8stream()
+	assert(cbuf.utf8feed(st, utext:sub(1, cut)) == -1 and cbuf.utf8feed(st, utext:sub(cut + 1)) == -1 and cbuf.utf8feed(st) == -1, "utf8 feed split at " .. cut)
+	assert(cbuf.utf8check(splitbufs(ubad, {cut, #ubad})) == 40, "utf8 error split at " .. cut)
+end
+assert(cbuf.utf8check(utext:sub(1, 12)) == 11, "utf8 truncated tail")
+local us = cbuf.utf8stream()
+print("utf8feed", cbuf.utf8feed(us, "caf\195"), cbuf.utf8feed(us), cbuf.utf8feed(us, "\169"), cbuf.utf8feed(us))
+local lines = cbuf.bufs()
+cbuf.append(lines, "one\ntwo\n\nthr")
+cbuf.append(lines, "ee\nfou")
+local recs, nrec = cbuf.split(lines, "\n")
+print("split", nrec, cbuf.tostring(recs[1]), cbuf.tostring(recs[4]), #lines)
+local crc1, crc2 = cbuf.crc32c("12345"), cbuf.crc32c("6789")
+print("crc32c", string.format("%08x", cbuf.crc32c("123456789")), cbuf.crc32c_combine(crc1, crc2, 4) == cbuf.crc32c("123456789"))
+assert(cbuf.crc32c("123456789") == 0xe3069283, "crc32c check value")
+assert(cbuf.crc32c_combine(crc1, crc2, 4) == 0xe3069283, "crc32c combine")
+local xs = cbuf.xxh64stream()
+cbuf.xxh64feed(cbuf.xxh64feed(xs, "Nobody inspects "), "the spammish repetition")
+print("xxh64", (cbuf.xxh64("Nobody inspects the spammish repetition")), cbuf.xxh64feed(xs) == cbuf.xxh64("Nobody inspects the spammish repetition"))
+assert(cbuf.xxh64("abc") == 0x44bc2cf5ad770999, "xxh64 check value")
+assert(cbuf.xxh64feed(xs) == cbuf.xxh64("Nobody inspects the spammish repetition"), "xxh64 stream")
+local xabc = cbuf.xxh64stream()
+cbuf.xxh64feed(cbuf.xxh64feed(xabc, "a"), "bc")
+assert(cbuf.xxh64feed(xabc) == 0x44bc2cf5ad770999, "xxh64 stream check value")
+print("hashpool", cbuf.hashpool(2, 1048576), cbuf.crc32c(cbuf.bufs()))
+local bigparts = {}
+for i = 1, 53 do bigparts[i] = string.rep(string.char(i, 255 - i, i * 3 % 256), 21845 + i) end
+local bigstr = table.concat(bigparts)
+local bigbufs = cbuf.bufs()
+for i = 1, #bigparts do cbuf.append(bigbufs, cbuf.buf(bigparts[i])) end
+assert(#bigbufs == #bigstr and #bigstr > 3 * 1048576, "crc input")
+cbuf.hashpool(0)
+local seqcrc, seqmid = cbuf.crc32c(bigbufs), cbuf.crc32c(bigbufs, 12345, 2500000, 77)
+cbuf.hashpool(3, 1048576)
+assert(cbuf.crc32c(bigbufs) == seqcrc and seqcrc == cbuf.crc32c(bigstr), "parallel crc32c")
+assert(cbuf.crc32c(bigbufs, 12345, 2500000, 77) == seqmid and seqmid == cbuf.crc32c(bigstr, 12345, 2500000, 77), "parallel crc32c range")
+local plain = string.rep("replicated log line ", 500)
+local packed = cbuf.compress(plain)
+print("compress", #plain, #packed, cbuf.tostring(cbuf.decompress(packed)) == plain, cbuf.decompress("junk"))
+local lz = cbuf.lzstream("compress")
+local lzout = cbuf.lzfeed(lz, plain)
+cbuf.concat(lzout, cbuf.lzfeed(lz))
+print("lzstream", #lzout, cbuf.tostring(cbuf.decompress(lzout)) == plain)
+local cache = cbuf.cache(4096)
+local r1, hit1 = cbuf.intern(cache, "static response")
+local r2, hit2 = cbuf.intern(cache, cbuf.buf("static response"))
+local own = cbuf.buf("AAAABBBB")
+local r3 = cbuf.intern(cache, own)
+cbuf.pack(own, 0, "<L", 0)
+assert(cbuf.tostring(r3) == "AAAABBBB", "intern copies the caller's buffer")
+assert(not pcall(function() cbuf.array(r3, "<L")[1] = 0 end) and not pcall(cbuf.pack, r3, 0, "<L", 0), "cached payload read-only")
+local pcache = cbuf.cache(64)
+local held = {}
+for i = 1, 8 do held[i] = cbuf.intern(pcache, string.rep(string.char(64 + i), 32)) end
+assert(#pcache == 8 and cbuf.cachestats(pcache).size == 256, "shared entries stay cached")
+held = nil
+collectgarbage()
+cbuf.intern(pcache, string.rep("z", 32))
+assert(cbuf.cachetrim(pcache) > 0 and cbuf.cachestats(pcache).size <= 64, "released entries trimmed")
+print("intern", hit1, hit2, cbuf.tostring(r2), #cache, cbuf.cachestats(cache).hits)
+local snap = cbuf.bufs()
+cbuf.append(snap, "warm ")
+cbuf.append(snap, "restart")
+print("save", cbuf.save("/tmp/cbuf-test.snap", snap, cbuf.bufs()))
+local s1, s2 = cbuf.load("/tmp/cbuf-test.snap")
+print("load", cbuf.tostring(s1), #s2, cbuf.load("/nonexistent/cbuf.snap"))
+assert(cbuf.tostring(s1) == "warm restart" and #s2 == 0, "snapshot round trip")
+local sf = io.open("/tmp/cbuf-test.snap", "rb")
+local sbytes = sf:read("*a")
+sf:close()
+sf = io.open("/tmp/cbuf-test.snap", "wb")
+sf:write(sbytes:sub(1, 16) .. "\3" .. sbytes:sub(18))
+sf:close()
+assert(cbuf.load("/tmp/cbuf-test.snap") == nil, "snapshot from another word size")
+os.remove("/tmp/cbuf-test.snap")
+local p0 = cbuf.pool({ enable = true, min = 40000 })
+assert(p0.enable and p0.min_size == 40000, "pool configured")
+local pa, pb = cbuf.buf(40000), cbuf.buf(70000)
+local p1 = cbuf.pool()
+assert(p1.allocs == p0.allocs + 2 and p1.used == p0.used + 65536 + 131072, "pool class rounding")
+local pc, pd = cbuf.buf(1000), cbuf.buf(5 * 1048576)
+assert(cbuf.pool().allocs == p1.allocs, "pool skips sizes outside its classes")
+pa, pb, pc, pd = nil
+collectgarbage()
+local p2 = cbuf.pool()
+assert(p2.used == p0.used and p2.mapped == p1.mapped, "pool blocks returned")
+pa = cbuf.buf(50000)
+local p3 = cbuf.pool()
+assert(p3.allocs == p2.allocs + 1 and p3.regions == p2.regions and p3.mapped == p2.mapped, "pool reuses freed blocks")
+print("pool", p3.allocs, p3.used, p3.regions, p3.mapped)
+pa = nil
+collectgarbage()
+assert(not cbuf.pool({}).enable and cbuf.pool().used == p0.used, "pool disabled")